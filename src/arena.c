@@ -0,0 +1,35 @@
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool arenaInit(arena *a, size_t size) {
+  *a = (arena){0};
+  // Over-allocate so the base can be aligned manually since C99 has no
+  // aligned_alloc
+  a->block = malloc(size + ARENA_ALIGN);
+  if (a->block == NULL) {
+    return false;
+  }
+  uintptr_t raw = (uintptr_t)a->block;
+  a->base = (unsigned char *)((raw + ARENA_ALIGN - 1) &
+                              ~(uintptr_t)(ARENA_ALIGN - 1));
+  a->size = size;
+  return true;
+}
+
+void *arenaAlloc(arena *a, size_t size, size_t align) {
+  size_t start = (a->used + align - 1) & ~(align - 1);
+  if (start > a->size || size > a->size - start) {
+    return NULL;
+  }
+  a->used = start + size;
+  void *ptr = a->base + start;
+  memset(ptr, 0, size);
+  return ptr;
+}
+
+void arenaFree(arena *a) {
+  free(a->block);
+  *a = (arena){0};
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Alignment of the arena base and the default alignment for allocations. One
+// cache line so that rows of cells never share a line with other storage
+enum { ARENA_ALIGN = 64 };
+
+// A bump allocator over a single heap block. Everything allocated from it is
+// released at once with arenaFree
+typedef struct {
+  void *block;
+  unsigned char *base;
+  size_t size;
+  size_t used;
+} arena;
+
+bool arenaInit(arena *a, size_t size);
+
+// Returns NULL if the arena does not have enough space left. align must be a
+// power of two
+void *arenaAlloc(arena *a, size_t size, size_t align);
+
+void arenaFree(arena *a);
@@ -1,5 +1,4 @@
 #include "block.h"
-#include "raylib.h"
 
 #include "rng.h"
 #include "utils.h"
@@ -25,28 +24,73 @@ bool IsGas(const Block *block) {
   return block != NULL && HAS_PROPERTY(BLOCKS[block->type].props, IS_GAS);
 }
 
-Color GenBlockColor(const enum BlockType type) {
+// Every possible type and variant byte pair of a cell, so looking up a colour
+// never needs a bounds check. Types that don't exist map to ERROR_COLOR
+static Color paletteTable[(UINT8_MAX + 1) << VARIANT_BITS];
+
+// Colour for cells with a type that does not exist, bright so it stands out
+static const Color ERROR_COLOR = {.r = 200, .g = 122, .b = 255, .a = 255};
+
+// Spread offset across [-range, range] by the variant index
+static float paletteOffset(int range, int index) {
+  return (-range + 2.0f * range * index / (PALETTE_SIZE - 1)) / 100.0f;
+}
+
+// Colour of one palette entry. The lightness and saturation offsets each cover
+// the material's whole range in even steps, with the saturation steps visited
+// in a different order so neighbouring variants differ in both
+static Color paletteColor(enum BlockType type, int variant) {
   BlockDef b = BLOCKS[type];
-  Color base = b.color;
   float h, s, l;
+  RGBtoHSL(b.color, &h, &s, &l);
+
+  l = fclampf(l + paletteOffset(b.lightnessVar, variant), 0.0f, 1.0f);
+  // 3 is coprime to the palette size, so this visits every step once
+  int satStep = variant * 3 % PALETTE_SIZE;
+  s = fclampf(s + paletteOffset(b.saturationVar, satStep), 0.0f, 1.0f);
+  return HSLtoRGB(h, s, l);
+}
 
-  RGBtoHSL(base, &h, &s, &l);
+void InitBlockPalettes(void) {
+  for (int type = 0; type <= UINT8_MAX; type++) {
+    for (int variant = 0; variant < PALETTE_SIZE; variant++) {
+      Color color = ERROR_COLOR;
+      if (type == AIR) {
+        // Air is never drawn, keep it fully transparent
+        color = BLOCKS[AIR].color;
+      } else if (type < BLOCK_TYPES_COUNT) {
+        color = paletteColor(type, variant);
+      }
+      paletteTable[type << VARIANT_BITS | variant] = color;
+    }
+  }
+}
+
+Color BlockColor(const Block *block) {
+  return paletteTable[block->type << VARIANT_BITS | block->variant];
+}
 
-  if (b.lightnessVar != 0) {
-    // Add subtle lightness variation
-    float lightness_var =
-        ((float)((int)(pcg32() % b.lightnessVar * 2 + 1) - b.lightnessVar)) /
-        100.0f;
-    l = fclampf(l + lightness_var, 0.0f, 1.0f);
+void BlockColorsRow(const Block *cells, int count, Color *out) {
+  for (int i = 0; i < count; i++) {
+    out[i] = paletteTable[cells[i].type << VARIANT_BITS | cells[i].variant];
   }
+}
 
-  if (b.saturationVar != 0) {
-    // Add subtle saturation variation
-    float sat_var =
-        ((float)((int)(pcg32() % b.saturationVar * 2 + 1) - b.saturationVar)) /
-        100.0f;
-    s = fclampf(s + sat_var, 0.0f, 1.0f);
+void NewBlocks(Block *cells, int count, enum BlockType type) {
+  const int perNumber = 32 / VARIANT_BITS;
+  for (int i = 0; i < count; i += perNumber) {
+    uint32_t bits = pcg32();
+    for (int j = i; j < min(i + perNumber, count); j++) {
+      cells[j] = (Block){.type = type,
+                         .variant = bits % PALETTE_SIZE,
+                         .movementDir = DIR_NONE};
+      bits >>= VARIANT_BITS;
+    }
   }
+}
 
-  return HSLtoRGB(h, s, l);
+Block NewBlock(enum BlockType type) {
+  return (Block){.type = type,
+                 .variant = pcg32() % PALETTE_SIZE,
+                 .movementDir = DIR_NONE};
 }
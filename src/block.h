@@ -1,6 +1,6 @@
 #pragma once
 
-#include "raylib.h"
+#include "color.h"
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -22,8 +22,6 @@ typedef enum {
 
 #define RGBA(r, g, b, a) ((Color){r, g, b, a})
 
-Color GenBlockColor(enum BlockType type);
-
 typedef enum { DIR_NONE, DIR_LEFT, DIR_RIGHT } Direction;
 
 typedef struct {
@@ -35,55 +33,96 @@ typedef struct {
   int lightnessVar;
   // Saturation variation in percent
   int saturationVar;
+  // Only for fluids, how many cells they can flow sideways in one tick
+  int dispersion;
 } BlockDef;
 
 static const BlockDef BLOCKS[BLOCK_TYPES_COUNT] = {
-    [AIR] = (BlockDef){.type = AIR,
-                       .displayName = "Air",
-                       .color = RGBA(0, 0, 0, 0),
-                       .props = IS_PASSIBLE,
-                       .lightnessVar = 0,
-                       .saturationVar = 0},
-    [SAND] = (BlockDef){.type = SAND,
-                        .displayName = "Sand",
-                        .color = RGBA(194, 178, 128, 255),
-                        .props = HAS_GRAVITY | CAN_SLIDE,
-                        .lightnessVar = 4,
-                        .saturationVar = 2},
-    [GRAVEL] = (BlockDef){.type = GRAVEL,
-                          .displayName = "Gravel",
-                          .color = RGBA(114, 114, 114, 255),
-                          .props = HAS_GRAVITY | CAN_SLIDE,
-                          .lightnessVar = 4,
-                          .saturationVar = 2},
-    [ROCK] = (BlockDef){.type = ROCK,
-                        .displayName = "Rock",
-                        .color = RGBA(171, 171, 171, 255),
-                        .props = NO_PROPS,
-                        .lightnessVar = 4,
-                        .saturationVar = 2},
-    [WATER] = (BlockDef){.type = WATER,
-                         .displayName = "Water",
-                         .color = RGBA(28, 163, 236, 255),
-                         .props = HAS_GRAVITY | CAN_SLIDE | IS_FLUID,
-                         .lightnessVar = 4,
-                         .saturationVar = 2},
-    [SMOKE] = (BlockDef){.type = SMOKE,
-                         .displayName = "Smoke",
-                         .color = RGBA(56, 56, 56, 255),
-                         .props = IS_PASSIBLE | IS_GAS,
-                         .lightnessVar = 4,
-                         .saturationVar = 2}};
+    [AIR] = {.type = AIR,
+             .displayName = "Air",
+             .color = RGBA(0, 0, 0, 0),
+             .props = IS_PASSIBLE,
+             .lightnessVar = 0,
+             .saturationVar = 0,
+             .dispersion = 0},
+    [SAND] = {.type = SAND,
+              .displayName = "Sand",
+              .color = RGBA(194, 178, 128, 255),
+              .props = HAS_GRAVITY | CAN_SLIDE,
+              .lightnessVar = 4,
+              .saturationVar = 2,
+              .dispersion = 0},
+    [GRAVEL] = {.type = GRAVEL,
+                .displayName = "Gravel",
+                .color = RGBA(114, 114, 114, 255),
+                .props = HAS_GRAVITY | CAN_SLIDE,
+                .lightnessVar = 4,
+                .saturationVar = 2,
+                .dispersion = 0},
+    [ROCK] = {.type = ROCK,
+              .displayName = "Rock",
+              .color = RGBA(171, 171, 171, 255),
+              .props = NO_PROPS,
+              .lightnessVar = 4,
+              .saturationVar = 2,
+              .dispersion = 0},
+    [WATER] = {.type = WATER,
+               .displayName = "Water",
+               .color = RGBA(28, 163, 236, 255),
+               .props = HAS_GRAVITY | CAN_SLIDE | IS_FLUID,
+               .lightnessVar = 4,
+               .saturationVar = 2,
+               .dispersion = 5},
+    [SMOKE] = {.type = SMOKE,
+               .displayName = "Smoke",
+               .color = RGBA(56, 56, 56, 255),
+               .props = IS_PASSIBLE | IS_GAS,
+               .lightnessVar = 4,
+               .saturationVar = 2,
+               .dispersion = 0}};
+
+// Number of bits used for the colour variant of a cell and the size of every
+// material's palette
+enum { VARIANT_BITS = 3, PALETTE_SIZE = 1 << VARIANT_BITS };
+
+// Number of bits used for the falling speed of a cell and the fastest speed
+enum { VELOCITY_BITS = 2, MAX_VELOCITY = (1 << VELOCITY_BITS) - 1 };
 
+// A single cell, packed into two bytes so moving one is a single 16-bit copy.
+// The colour is not stored, only which entry of the material's palette to use
 typedef struct {
-  enum BlockType type;
-  Color color;
+  uint8_t type;
+  uint8_t variant : VARIANT_BITS;
   // Only for fluids so they keep moving in the same direction
-  // For non fluids, this will have a garbage value because it will never be
-  // initialized, and hopefully never used
-  Direction movementDir;
+  uint8_t movementDir : 2;
+  // Set while the tick runs on cells that already moved, so they only move
+  // once per tick. Always clear between ticks
+  uint8_t updated : 1;
+  // How fast the cell is falling. Grows every tick it falls the whole way and
+  // drops to 0 once it lands, see FALL_DISTANCE in world.c
+  uint8_t velocity : VELOCITY_BITS;
 } Block;
 
+// Fails to compile if Block grows past two bytes
+typedef char block_size_check[sizeof(Block) == 2 ? 1 : -1];
+
+// Build the colour palettes of every material from its lightness and
+// saturation ranges. Must be called once before BlockColor is used
+void InitBlockPalettes(void);
+
+Color BlockColor(const Block *block);
+
+// Colours of count cells in a row, written to out. A single table lookup per
+// cell with no branches, so it vectorizes
+void BlockColorsRow(const Block *cells, int count, Color *out);
+
+// A new cell of the given type with a random colour variant
+Block NewBlock(enum BlockType type);
+
+// Fill count cells with new cells of the given type. Cheaper per cell than
+// NewBlock since every random number gives the variants of several cells
+void NewBlocks(Block *cells, int count, enum BlockType type);
+
 bool HasGravity(const Block *block);
 bool IsPassible(const Block *block);
 bool CanSlide(const Block *block);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Little endian writers for the binary file formats
+
+static inline void putU8(FILE *file, uint8_t value) { fputc(value, file); }
+
+static inline void putU16(FILE *file, uint16_t value) {
+  putU8(file, value & 0xff);
+  putU8(file, value >> 8);
+}
+
+static inline void putU32(FILE *file, uint32_t value) {
+  putU16(file, value & 0xffff);
+  putU16(file, value >> 16);
+}
+
+static inline void putU64(FILE *file, uint64_t value) {
+  putU32(file, value & 0xffffffff);
+  putU32(file, value >> 32);
+}
@@ -0,0 +1,113 @@
+#include "cells.h"
+
+enum { CHUNK_UNIFORM, CHUNK_RUNS };
+
+enum { DIR_SHIFT = VARIANT_BITS, VELOCITY_SHIFT = DIR_SHIFT + 2 };
+
+static inline bool sameCell(const Block *a, const Block *b) {
+  return a->type == b->type && a->variant == b->variant &&
+         a->movementDir == b->movementDir && a->velocity == b->velocity;
+}
+
+static void encodeCell(uint8_t *out, const Block *block) {
+  out[0] = block->type;
+  out[1] = block->variant | block->movementDir << DIR_SHIFT |
+           block->velocity << VELOCITY_SHIFT;
+}
+
+// Returns false if the bytes are not a valid cell
+static bool decodeCell(const uint8_t *in, Block *block) {
+  int dir = (in[1] >> DIR_SHIFT) & 3;
+  int velocity = in[1] >> VELOCITY_SHIFT;
+  if (in[0] >= BLOCK_TYPES_COUNT || dir > DIR_RIGHT ||
+      velocity > MAX_VELOCITY) {
+    return false;
+  }
+  *block = (Block){.type = in[0],
+                   .variant = in[1] & (PALETTE_SIZE - 1),
+                   .movementDir = dir,
+                   .velocity = velocity};
+  return true;
+}
+
+static bool isUniform(const Block *cells, int stride, int width, int height) {
+  for (int y = 0; y < height; y++) {
+    const Block *row = &cells[(size_t)y * stride];
+    for (int x = 0; x < width; x++) {
+      if (!sameCell(&row[x], &cells[0])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+size_t encodeChunk(const Block *cells, int stride, int width, int height,
+                   uint8_t *out) {
+  size_t size = 0;
+  if (isUniform(cells, stride, width, height)) {
+    out[size++] = CHUNK_UNIFORM;
+    encodeCell(&out[size], &cells[0]);
+    return size + ENCODED_CELL_SIZE;
+  }
+
+  out[size++] = CHUNK_RUNS;
+  for (int y = 0; y < height; y++) {
+    const Block *row = &cells[(size_t)y * stride];
+    int x = 0;
+    while (x < width) {
+      int run = 1;
+      while (x + run < width && sameCell(&row[x + run], &row[x])) {
+        run++;
+      }
+      out[size++] = run;
+      encodeCell(&out[size], &row[x]);
+      size += ENCODED_CELL_SIZE;
+      x += run;
+    }
+  }
+  return size;
+}
+
+static inline void fillRun(Block *row, int x, int count, Block cell) {
+  for (int i = x; i < x + count; i++) {
+    row[i] = cell;
+  }
+}
+
+size_t decodeChunk(const uint8_t *data, size_t size, Block *cells, int stride,
+                   int width, int height) {
+  Block cell;
+  if (size < 1 + ENCODED_CELL_SIZE) {
+    return 0;
+  }
+  if (data[0] == CHUNK_UNIFORM) {
+    if (!decodeCell(&data[1], &cell)) {
+      return 0;
+    }
+    for (int y = 0; cells != NULL && y < height; y++) {
+      fillRun(&cells[(size_t)y * stride], 0, width, cell);
+    }
+    return 1 + ENCODED_CELL_SIZE;
+  }
+  if (data[0] != CHUNK_RUNS) {
+    return 0;
+  }
+
+  size_t pos = 1;
+  for (int y = 0; y < height; y++) {
+    int x = 0;
+    while (x < width) {
+      if (size - pos < 1 + ENCODED_CELL_SIZE || data[pos] == 0 ||
+          data[pos] > width - x || !decodeCell(&data[pos + 1], &cell)) {
+        return 0;
+      }
+      if (cells != NULL) {
+        fillRun(&cells[(size_t)y * stride], x, data[pos], cell);
+      }
+      x += data[pos];
+      pos += 1 + ENCODED_CELL_SIZE;
+    }
+  }
+  return pos;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "block.h"
+#include "chunk.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The encoding of cells shared by saved games and the chunk store.
+//
+// A cell is encoded as its type byte followed by a byte with the variant in
+// the low bits, then the movement direction and the velocity. The updated flag
+// is never stored.
+//
+// A chunk is encoded as a kind byte. A uniform chunk is followed by its one
+// cell, any other by its rows from the bottom, each as runs of a length and a
+// cell. Runs never continue into the next row.
+
+enum {
+  ENCODED_CELL_SIZE = 2,
+  // Largest encoded chunk, the kind byte and a run for every cell
+  MAX_ENCODED_CHUNK_SIZE =
+      1 + CHUNK_SIZE * CHUNK_SIZE * (1 + ENCODED_CELL_SIZE),
+};
+
+// Encode the width x height cells starting at cells, stride cells apart from
+// one row to the next, into out, which has room for MAX_ENCODED_CHUNK_SIZE
+// bytes. Returns the encoded size
+size_t encodeChunk(const Block *cells, int stride, int width, int height,
+                   uint8_t *out);
+
+// Decode a chunk of width x height cells from the size bytes at data into
+// cells, laid out like for encodeChunk. With cells NULL it only checks the
+// data. Returns the number of bytes the chunk took, or 0 if it is not valid
+size_t decodeChunk(const uint8_t *data, size_t size, Block *cells, int stride,
+                   int width, int height);
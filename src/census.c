@@ -0,0 +1,276 @@
+#include "census.h"
+#include "changes.h"
+#include "chunk.h"
+#include "state.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct {
+  // Cells of each type in each chunk, BLOCK_TYPES_COUNT per chunk
+  uint32_t *counts;
+  // The counts as they were last added to the trees and totals
+  uint32_t *indexed;
+  // Chunks to count again from their cells
+  bool *stale;
+  // Set when any chunk may be stale
+  bool anyStale;
+  // Fenwick tree over the chunks for each type, stored like the chunks. Sums
+  // wrap around on the way but always come out as the right count
+  uint32_t *trees[BLOCK_TYPES_COUNT];
+  uint64_t totals[BLOCK_TYPES_COUNT];
+  // Where the census is in the list of changes
+  change_cursor changes;
+} census;
+
+static inline int chunkIndex(int x, int y) {
+  return y / CHUNK_SIZE * _state.chunksX + x / CHUNK_SIZE;
+}
+
+static void freeCounts(uint32_t *counts, uint32_t *indexed, bool *stale,
+                       uint32_t *trees[BLOCK_TYPES_COUNT]) {
+  free(counts);
+  free(indexed);
+  free(stale);
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    free(trees[type]);
+  }
+}
+
+bool censusInit(int chunks) {
+  uint32_t *counts =
+      calloc((size_t)chunks * BLOCK_TYPES_COUNT, sizeof(uint32_t));
+  uint32_t *indexed =
+      calloc((size_t)chunks * BLOCK_TYPES_COUNT, sizeof(uint32_t));
+  bool *stale = calloc(chunks, sizeof(bool));
+  uint32_t *trees[BLOCK_TYPES_COUNT];
+  bool ok = counts != NULL && indexed != NULL && stale != NULL;
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    trees[type] = calloc(chunks, sizeof(uint32_t));
+    ok = ok && trees[type] != NULL;
+  }
+  if (!ok) {
+    freeCounts(counts, indexed, stale, trees);
+    return false;
+  }
+
+  freeCounts(census.counts, census.indexed, census.stale, census.trees);
+  census.counts = counts;
+  census.indexed = indexed;
+  census.stale = stale;
+  memcpy(census.trees, trees, sizeof(trees));
+  memset(census.totals, 0, sizeof(census.totals));
+  census.anyStale = false;
+  // The cursor of no world, so the first read indexes every chunk. The world
+  // the counts are for doesn't exist yet to subscribe to
+  census.changes = (change_cursor){0};
+  return true;
+}
+
+static inline void addCount(int chunk, uint8_t type, int delta, bool atomic) {
+  uint32_t *count = &census.counts[chunk * BLOCK_TYPES_COUNT + type];
+  if (atomic) {
+    __atomic_fetch_add(count, delta, __ATOMIC_RELAXED);
+  } else {
+    *count += delta;
+  }
+}
+
+void censusSwap(int ax, int ay, int bx, int by, uint8_t typeA, uint8_t typeB,
+                bool atomic) {
+  int a = chunkIndex(ax, ay);
+  int b = chunkIndex(bx, by);
+  if (a == b || typeA == typeB) {
+    return;
+  }
+  addCount(a, typeA, -1, atomic);
+  addCount(a, typeB, 1, atomic);
+  addCount(b, typeB, -1, atomic);
+  addCount(b, typeA, 1, atomic);
+}
+
+void censusSetCell(int x, int y, uint8_t oldType, uint8_t newType) {
+  int chunk = chunkIndex(x, y);
+  addCount(chunk, oldType, -1, false);
+  addCount(chunk, newType, 1, false);
+}
+
+void censusMarkSpan(int y, int minX, int maxX) {
+  for (int cx = minX / CHUNK_SIZE; cx <= maxX / CHUNK_SIZE; cx++) {
+    census.stale[y / CHUNK_SIZE * _state.chunksX + cx] = true;
+  }
+  census.anyStale = true;
+}
+
+void censusMarkAll(void) {
+  memset(census.stale, 1, (size_t)_state.chunksX * _state.chunksY);
+  census.anyStale = true;
+}
+
+static void recountChunk(int chunk) {
+  uint32_t *counts = &census.counts[chunk * BLOCK_TYPES_COUNT];
+  memset(counts, 0, BLOCK_TYPES_COUNT * sizeof(uint32_t));
+  int minX = chunk % _state.chunksX * CHUNK_SIZE;
+  int minY = chunk / _state.chunksX * CHUNK_SIZE;
+  int maxX = min(minX + CHUNK_SIZE, _state.width) - 1;
+  int maxY = min(minY + CHUNK_SIZE, _state.height) - 1;
+  for (int y = minY; y <= maxY; y++) {
+    const Block *row = &_state.world[(size_t)y * _state.width];
+    for (int x = minX; x <= maxX; x++) {
+      counts[row[x].type]++;
+    }
+  }
+  census.stale[chunk] = false;
+}
+
+void censusRefresh(void) {
+  if (!census.anyStale) {
+    return;
+  }
+  int chunks = _state.chunksX * _state.chunksY;
+  for (int i = 0; i < chunks; i++) {
+    if (census.stale[i]) {
+      recountChunk(i);
+    }
+  }
+  census.anyStale = false;
+}
+
+bool censusChunkHolds(int chunk, uint32_t types) {
+  const uint32_t *counts = &census.counts[chunk * BLOCK_TYPES_COUNT];
+  for (; types != 0; types &= types - 1) {
+    if (counts[__builtin_ctz(types)] != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void treeAdd(uint32_t *tree, int cx, int cy, uint32_t delta) {
+  for (int y = cy + 1; y <= _state.chunksY; y += y & -y) {
+    for (int x = cx + 1; x <= _state.chunksX; x += x & -x) {
+      tree[(y - 1) * _state.chunksX + x - 1] += delta;
+    }
+  }
+}
+
+// Sum of the chunks left of cx and below cy
+static uint32_t treeSum(const uint32_t *tree, int cx, int cy) {
+  uint32_t sum = 0;
+  for (int y = cy; y > 0; y -= y & -y) {
+    for (int x = cx; x > 0; x -= x & -x) {
+      sum += tree[(y - 1) * _state.chunksX + x - 1];
+    }
+  }
+  return sum;
+}
+
+// Bring the trees and totals up to date with the chunk's counts, counting it
+// again first if it was written a span at a time
+static void indexChunk(int chunk) {
+  if (census.stale[chunk]) {
+    recountChunk(chunk);
+  }
+  uint32_t *counts = &census.counts[chunk * BLOCK_TYPES_COUNT];
+  uint32_t *indexed = &census.indexed[chunk * BLOCK_TYPES_COUNT];
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    if (counts[type] == indexed[type]) {
+      continue;
+    }
+    uint32_t delta = counts[type] - indexed[type];
+    treeAdd(census.trees[type], chunk % _state.chunksX,
+            chunk / _state.chunksX, delta);
+    census.totals[type] += (int32_t)delta;
+    indexed[type] = counts[type];
+  }
+}
+
+// Index every chunk that changed since the last sync. Every count that
+// changes is in a chunk with cells that changed
+static void syncCensus(void) {
+  world_change changes[CHANGE_BATCH];
+  int count;
+  while ((count = changesRead(&census.changes, changes, CHANGE_BATCH)) != 0) {
+    if (count < 0) {
+      int chunks = _state.chunksX * _state.chunksY;
+      for (int i = 0; i < chunks; i++) {
+        indexChunk(i);
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      indexChunk(changes[i].chunk);
+    }
+  }
+}
+
+uint64_t censusTotal(enum BlockType type) {
+  syncCensus();
+  return census.totals[type];
+}
+
+void censusTotals(uint64_t totals[BLOCK_TYPES_COUNT]) {
+  syncCensus();
+  memcpy(totals, census.totals, sizeof(census.totals));
+}
+
+static uint64_t countCells(uint8_t type, int minX, int minY, int maxX,
+                           int maxY) {
+  uint64_t count = 0;
+  for (int y = minY; y <= maxY; y++) {
+    const Block *row = &_state.world[(size_t)y * _state.width];
+    for (int x = minX; x <= maxX; x++) {
+      count += row[x].type == type;
+    }
+  }
+  return count;
+}
+
+// First chunk whose cells all lie at or after the cell
+static int firstWholeChunk(int min) {
+  return (min + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+// Last chunk whose cells all lie at or before the cell of a row or column of
+// size cells. The last chunk of the world may be cut short by its edge
+static int lastWholeChunk(int max, int size) {
+  return max == size - 1 ? (size - 1) / CHUNK_SIZE
+                         : (max + 1) / CHUNK_SIZE - 1;
+}
+
+uint64_t censusCount(enum BlockType type, int minX, int minY, int maxX,
+                     int maxY) {
+  minX = max(minX, 0);
+  minY = max(minY, 0);
+  maxX = min(maxX, _state.width - 1);
+  maxY = min(maxY, _state.height - 1);
+  if (minX > maxX || minY > maxY) {
+    return 0;
+  }
+  syncCensus();
+
+  int firstX = firstWholeChunk(minX);
+  int firstY = firstWholeChunk(minY);
+  int lastX = lastWholeChunk(maxX, _state.width);
+  int lastY = lastWholeChunk(maxY, _state.height);
+  if (firstX > lastX || firstY > lastY) {
+    return countCells(type, minX, minY, maxX, maxY);
+  }
+
+  const uint32_t *tree = census.trees[type];
+  uint64_t count = (uint32_t)(treeSum(tree, lastX + 1, lastY + 1) -
+                              treeSum(tree, firstX, lastY + 1) -
+                              treeSum(tree, lastX + 1, firstY) +
+                              treeSum(tree, firstX, firstY));
+
+  // The cells around the whole chunks: full rows below and above them, and
+  // the ends of the rows beside them
+  int innerMinX = firstX * CHUNK_SIZE;
+  int innerMinY = firstY * CHUNK_SIZE;
+  int innerMaxX = min((lastX + 1) * CHUNK_SIZE, _state.width) - 1;
+  int innerMaxY = min((lastY + 1) * CHUNK_SIZE, _state.height) - 1;
+  count += countCells(type, minX, minY, maxX, innerMinY - 1);
+  count += countCells(type, minX, innerMaxY + 1, maxX, maxY);
+  count += countCells(type, minX, innerMinY, innerMinX - 1, innerMaxY);
+  count += countCells(type, innerMaxX + 1, innerMinY, maxX, innerMaxY);
+  return count;
+}
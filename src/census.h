@@ -0,0 +1,67 @@
+#pragma once
+
+#include "block.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// How many cells of each material the world holds and where, so counting them
+// costs about the number of chunks instead of the number of cells.
+//
+// Every chunk keeps a count of its cells of each material. The tick only ever
+// swaps cells, so it only changes the counts when a swap crosses from one
+// chunk to another and moves a cell of each material across. setBlock updates
+// the counts of its cell, while writes of whole spans mark their chunks to be
+// counted again from the cells on the next query.
+//
+// The counts of a chunk are exact from censusRefresh until the next span
+// write, which lets the tick skip the chunks that hold nothing it could move.
+//
+// On top of the counts there is a 2D Fenwick tree over the chunks for every
+// material, a summed-area table that can be updated a chunk at a time, along
+// with the world totals. Both are brought up to date before each query from
+// the chunks in the list of changes, see changes.h.
+//
+// Like the world, the census must only be used by the thread that owns it.
+
+// Allocate the counts for a world of the given number of chunks. Called by
+// initWorld before it replaces the world, which it then clears and so marks
+// every chunk to be counted. Returns false and keeps the counts as they were if
+// they can't be allocated
+bool censusInit(int chunks);
+
+// Account for the swap of cell a of type typeA with cell b of type typeB.
+// atomic must be set when other threads may swap cells at the same time
+void censusSwap(int ax, int ay, int bx, int by, uint8_t typeA, uint8_t typeB,
+                bool atomic);
+
+// Account for a cell whose type changed
+void censusSetCell(int x, int y, uint8_t oldType, uint8_t newType);
+
+// Count the chunks holding cells minX to maxX of row y again on the next
+// query, after they were written without going through censusSetCell
+void censusMarkSpan(int y, int minX, int maxX);
+
+// Count every chunk again on the next query
+void censusMarkAll(void);
+
+// Count the chunks marked by span writes again now, so the counts of every
+// chunk are exact until the next span write. Called by the tick before it
+// starts
+void censusRefresh(void);
+
+// Whether the chunk holds a cell of any of the types in the bitmask of types.
+// Only exact after censusRefresh, and only safe to call while the tick runs in
+// parallel for a chunk whose counts no other thread can change
+bool censusChunkHolds(int chunk, uint32_t types);
+
+// Cells of the type in the world
+uint64_t censusTotal(enum BlockType type);
+
+// Cells of every type in the world, indexed by type
+void censusTotals(uint64_t totals[BLOCK_TYPES_COUNT]);
+
+// Cells of the type in the rect from minX, minY to maxX, maxY inclusive,
+// clipped to the world. The chunks inside the rect are summed from the trees
+// and only the cells of the chunks its edges cut through are looked at
+uint64_t censusCount(enum BlockType type, int minX, int minY, int maxX,
+                     int maxY);
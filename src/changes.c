@@ -0,0 +1,128 @@
+#include "changes.h"
+#include "chunk.h"
+#include "state.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  // The ring holds the changes of a few ticks that changed every chunk, so a
+  // reader that reads after every tick never falls behind
+  CHANGE_TICKS = 4,
+  MIN_CHANGES = 1024,
+};
+
+static struct {
+  world_change *ring;
+  // Always a power of two
+  uint64_t capacity;
+  // Changes ever added. The next one goes at head modulo the capacity
+  uint64_t head;
+  // Counts the calls to changesInit, so the cursors of another world can be
+  // told apart
+  uint64_t world;
+  // Chunks whose changed cells were empty when they were last marked, so the
+  // next collect only visits the chunks that changed. Never shrinks, which
+  // keeps it large enough for the world when initWorld fails after sizing it
+  int *marked;
+  int markedCount;
+  int markedCapacity;
+} changes;
+
+bool changesInit(int chunks) {
+  uint64_t capacity = MIN_CHANGES;
+  while (capacity < (uint64_t)chunks * CHANGE_TICKS) {
+    capacity *= 2;
+  }
+  world_change *ring = changes.ring;
+  if (capacity != changes.capacity) {
+    ring = malloc(capacity * sizeof(world_change));
+  }
+  int *marked = changes.marked;
+  if (chunks > changes.markedCapacity) {
+    marked = malloc((size_t)chunks * sizeof(int));
+  }
+  if (ring == NULL || marked == NULL) {
+    if (ring != changes.ring) {
+      free(ring);
+    }
+    if (marked != changes.marked) {
+      free(marked);
+    }
+    return false;
+  }
+
+  if (ring != changes.ring) {
+    free(changes.ring);
+    changes.ring = ring;
+    changes.capacity = capacity;
+  }
+  if (marked != changes.marked) {
+    if (changes.markedCount > 0) {
+      memcpy(marked, changes.marked, changes.markedCount * sizeof(int));
+    }
+    free(changes.marked);
+    changes.marked = marked;
+    changes.markedCapacity = chunks;
+  }
+  changes.world++;
+  return true;
+}
+
+void changesMark(int chunk, const cell_rect *rect) {
+  cell_rect *changed = &_state.chunks[chunk].changed;
+  if (changed->minX > changed->maxX) {
+    changes.marked[changes.markedCount++] = chunk;
+  }
+  changed->minX = min(changed->minX, rect->minX);
+  changed->minY = min(changed->minY, rect->minY);
+  changed->maxX = max(changed->maxX, rect->maxX);
+  changed->maxY = max(changed->maxY, rect->maxY);
+}
+
+void changesMarkAll(void) {
+  int count = _state.chunksX * _state.chunksY;
+  for (int i = 0; i < count; i++) {
+    int minX = i % _state.chunksX * CHUNK_SIZE;
+    int minY = i / _state.chunksX * CHUNK_SIZE;
+    _state.chunks[i].changed =
+        (cell_rect){.minX = minX,
+                    .minY = minY,
+                    .maxX = min(minX + CHUNK_SIZE, _state.width) - 1,
+                    .maxY = min(minY + CHUNK_SIZE, _state.height) - 1};
+    changes.marked[i] = i;
+  }
+  changes.markedCount = count;
+}
+
+void changesCollect(void) {
+  for (int i = 0; i < changes.markedCount; i++) {
+    int chunk = changes.marked[i];
+    cell_rect *rect = &_state.chunks[chunk].changed;
+    changes.ring[changes.head++ & (changes.capacity - 1)] =
+        (world_change){.tick = _state.tick, .chunk = chunk, .rect = *rect};
+    *rect = EMPTY_RECT;
+  }
+  changes.markedCount = 0;
+}
+
+change_cursor changesSubscribe(void) {
+  changesCollect();
+  return (change_cursor){.next = changes.head, .world = changes.world};
+}
+
+int changesRead(change_cursor *cursor, world_change *out, int size) {
+  changesCollect();
+  if (cursor->world != changes.world ||
+      changes.head - cursor->next > changes.capacity) {
+    *cursor = changesSubscribe();
+    return -1;
+  }
+
+  int count = (int)min(changes.head - cursor->next, (uint64_t)size);
+  for (int i = 0; i < count; i++) {
+    out[i] = changes.ring[(cursor->next + i) & (changes.capacity - 1)];
+  }
+  cursor->next += count;
+  return count;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "chunk.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A list of the parts of the world that changed, so anything kept from the
+// cells can be brought up to date with work in proportion to what changed
+// instead of to the size of the world.
+//
+// Each chunk keeps the bounds of its cells written since the last collect.
+// wakeArea, and so setBlock and every edit, grows them by the cells it is
+// given, clearWorld by the whole world and the tick by the cells it updated
+// and woke, which hold every cell it wrote. The chunks whose bounds grow from
+// empty are listed as they are marked, and changesCollect turns the bounds of
+// each listed chunk into a change in the list, so it costs the number of
+// chunks that changed. worldTick collects after every tick and changesRead
+// before reading, so edits are seen without waiting for one.
+//
+// The changes are kept in a ring that is reused once it is full. Every reader
+// has a cursor of its own and reads the changes added since it last read. A
+// reader that falls more than the ring behind is told so and has to treat the
+// whole world as changed. Like the world, the list must only be used by the
+// thread that owns the world.
+
+// Changes the readers in the core copy out of the list at a time
+enum { CHANGE_BATCH = 256 };
+
+typedef struct {
+  // Ticks run when the change was collected
+  uint64_t tick;
+  // Index of the chunk the change is in
+  int chunk;
+  // The cells of the chunk that may have changed
+  cell_rect rect;
+} world_change;
+
+// Where a reader is in the list
+typedef struct {
+  uint64_t next;
+  // The world the cursor was made for. Its changes are all lost once
+  // initWorld makes another one. A zeroed cursor is of no world at all
+  uint64_t world;
+} change_cursor;
+
+// Size the list for a world of the given number of chunks, losing every cursor
+// of the one before. Called by initWorld before it replaces the world. Returns
+// false and keeps the list as it was if it can't be allocated
+bool changesInit(int chunks);
+
+// Grow the changed cells of the chunk by rect, which must be inside it
+void changesMark(int chunk, const cell_rect *rect);
+
+// Mark every cell of the world as changed
+void changesMarkAll(void);
+
+// Add a change for every chunk with cells written since the last collect
+void changesCollect(void);
+
+// A cursor that reads the changes made from now on
+change_cursor changesSubscribe(void);
+
+// Collect, then copy up to size of the changes after the cursor to out and move
+// the cursor past them. Returns how many were copied, 0 once the cursor is
+// at the end of the list, or -1 if changes it had not read were dropped. The
+// cursor is then moved to the end of the list and every cell has to be
+// treated as changed
+int changesRead(change_cursor *cursor, world_change *out, int size);
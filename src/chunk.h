@@ -0,0 +1,38 @@
+#pragma once
+
+#include <limits.h>
+
+// Side length of the square chunks the world is split into to track which
+// parts of it are still moving
+enum { CHUNK_SIZE = 32 };
+
+// How far around a changed cell other cells can be affected by it. A sleeping
+// cell only starts to move when a neighbour within two cells of it changes.
+// Cells read further when they update, up to 8 cells when falling and 9 when
+// flowing, but only once they are already awake
+enum { WAKE_MARGIN = 2 };
+
+// Inclusive bounds of a rectangle of cells. Empty when minX > maxX
+//
+// The empty rect uses the extreme values so growing a rect is the same min and
+// max per field whether or not it was empty
+typedef struct {
+  int minX;
+  int minY;
+  int maxX;
+  int maxY;
+} cell_rect;
+
+#define EMPTY_RECT                                                             \
+  ((cell_rect){                                                                \
+      .minX = INT_MAX, .minY = INT_MAX, .maxX = INT_MIN, .maxY = INT_MIN})
+
+typedef struct {
+  // Cells to update during the current tick. A chunk with an empty rect is
+  // asleep and skipped entirely
+  cell_rect dirty;
+  // Cells to update during the next tick
+  cell_rect nextDirty;
+  // Cells written since the changes were last collected, see changes.h
+  cell_rect changed;
+} chunk;
@@ -0,0 +1,15 @@
+#pragma once
+
+// The simulation core only needs raylib's Color struct, so it is declared here
+// with the same layout to keep the core free of the raylib dependency.
+// raylib.h defines RL_COLOR_TYPE when it declares Color, so any file that uses
+// raylib must include raylib.h before this header.
+#if !defined(RL_COLOR_TYPE)
+typedef struct Color {
+  unsigned char r;
+  unsigned char g;
+  unsigned char b;
+  unsigned char a;
+} Color;
+#define RL_COLOR_TYPE
+#endif
@@ -4,35 +4,51 @@
 
 #define TWO_THIRDS (2.0f / 3.0f)
 
+// Zoom factor of one step of the mouse wheel
+#define ZOOM_STEP 1.25f
+
 // Better than using define to make these actually constant
 enum {
   PHYSICS_FPS = 20,
   RENDER_FPS = 60,
 
-  WORLD_WIDTH = 60,
-  WORLD_HEIGHT = 60,
+  // The world size is chosen at startup, these are the defaults and limits
+  DEFAULT_WORLD_WIDTH = 60,
+  DEFAULT_WORLD_HEIGHT = 60,
+  MIN_WORLD_SIZE = 60,
+  MAX_WORLD_SIZE = 4096,
+
+  // Scale a cell is drawn at with the whole world in view. Bigger worlds are
+  // zoomed out so they still fit in MAX_WORLD_DISPLAY_SIZE
   PX_SCALE = 10,
+  MAX_WORLD_DISPLAY_SIZE = 800,
+  // Closest the camera zooms in to, in pixels per cell
+  MAX_ZOOM = 40,
+  // The grid is only drawn once cells are at least this many pixels wide
+  GRID_MIN_ZOOM = 4,
 
   WORLD_DISPLAY_PADDING = 20,
 
   INTERFACE_HEIGHT = 200,
   INTERFACE_WIDTH = 600,
 
-  SCREEN_WIDTH =
-      max(WORLD_WIDTH * PX_SCALE + WORLD_DISPLAY_PADDING * 2, INTERFACE_WIDTH),
-  SCREEN_HEIGHT =
-      WORLD_HEIGHT * PX_SCALE + WORLD_DISPLAY_PADDING * 2 + INTERFACE_HEIGHT,
+  ERROR_CHECKERBOARD_WIDTH = 2,
 
-  WORLD_SCREEN_TOP_LEFT_X = (SCREEN_WIDTH - WORLD_WIDTH * PX_SCALE) / 2,
-  WORLD_SCREEN_TOP_LEFT_Y = WORLD_DISPLAY_PADDING,
-  WORLD_SCREEN_BOTTOM_RIGHT_X = (SCREEN_WIDTH + WORLD_WIDTH * PX_SCALE) / 2,
-  WORLD_SCREEN_BOTTOM_RIGHT_Y =
-      (WORLD_HEIGHT * PX_SCALE + WORLD_DISPLAY_PADDING),
+  // Memory the undo history may use for the chunks it keeps, on top of one
+  // copy of the world
+  HISTORY_BUDGET = 64 << 20,
+  // The simulation starts a new undo step on its own this often, so undo can
+  // rewind it without waiting for an edit
+  HISTORY_STEP_TICKS = 10 * PHYSICS_FPS,
 
-  ERROR_CHECKERBOARD_WIDTH = 2,
+  // Default memory the chunk store keeps the map outside of the world in
+  // before writing chunks to disk
+  STREAM_BUDGET = 64 << 20,
 };
 
+// Where the Save Game and Load Game buttons keep the game
+#define SAVE_FILE "world.sav"
+
 #define GRID_LINE_COLOR ((Color){50, 50, 50, 255})
 
-#define AIR_BLOCK                                                              \
-  ((Block){.type = AIR, .color = {0, 0, 0, 0}, .movementDir = DIR_NONE})
+#define AIR_BLOCK ((Block){.type = AIR, .variant = 0, .movementDir = DIR_NONE})
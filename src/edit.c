@@ -0,0 +1,373 @@
+#include "edit.h"
+#include "chunk.h"
+#include "consts.h"
+#include "planes.h"
+#include "state.h"
+#include "utils.h"
+#include "world.h"
+#include <math.h>
+#include <stdlib.h>
+
+bool isValidEdit(const world_edit *edit) {
+  const int coords[] = {edit->x0, edit->y0, edit->x1, edit->y1};
+  for (size_t i = 0; i < sizeof(coords) / sizeof(coords[0]); i++) {
+    if (coords[i] < -MAX_WORLD_SIZE || coords[i] >= MAX_WORLD_SIZE * 2) {
+      return false;
+    }
+  }
+  return edit->type < EDIT_TYPES_COUNT && edit->width >= 1 &&
+         edit->width <= MAX_WORLD_SIZE && edit->blockType < BLOCK_TYPES_COUNT &&
+         edit->fromType < BLOCK_TYPES_COUNT;
+}
+
+// The rectangle between the two corners in any order, clipped to the world.
+// Empty if it lies outside of it
+static cell_rect clipRect(int x0, int y0, int x1, int y1) {
+  return (cell_rect){.minX = max(min(x0, x1), 0),
+                     .minY = max(min(y0, y1), 0),
+                     .maxX = min(max(x0, x1), _state.width - 1),
+                     .maxY = min(max(y0, y1), _state.height - 1)};
+}
+
+// Paint cells minX to maxX of row y, which must lie inside the world. Returns
+// whether any cell changed
+static bool paintSpan(int y, int minX, int maxX, enum BlockType type) {
+  Block *row = &_state.world[(size_t)y * _state.width];
+  bool changed = false;
+  for (int x = minX; x <= maxX; x++) {
+    if (row[x].type != type) {
+      row[x] = NewBlock(type);
+      changed = true;
+    }
+  }
+  if (changed) {
+    setPlaneSpan(y, minX, maxX, type);
+  }
+  return changed;
+}
+
+static void paintRect(cell_rect rect, enum BlockType type) {
+  if (rect.minX > rect.maxX || rect.minY > rect.maxY) {
+    return;
+  }
+  bool changed = false;
+  for (int y = rect.minY; y <= rect.maxY; y++) {
+    changed |= paintSpan(y, rect.minX, rect.maxX, type);
+  }
+  if (changed) {
+    wakeArea(rect.minX, rect.minY, rect.maxX, rect.maxY);
+  }
+}
+
+static void paintCircle(int cx, int cy, int width, enum BlockType type) {
+  int radius = width / 2;
+  cell_rect bounds =
+      clipRect(cx - radius, cy - radius, cx + radius, cy + radius);
+  if (bounds.minX > bounds.maxX || bounds.minY > bounds.maxY) {
+    return;
+  }
+  bool changed = false;
+  for (int y = bounds.minY; y <= bounds.maxY; y++) {
+    int dy = y - cy;
+    int half = (int)sqrt((double)(radius * radius - dy * dy));
+    int minX = max(cx - half, 0);
+    int maxX = min(cx + half, _state.width - 1);
+    if (minX <= maxX) {
+      changed |= paintSpan(y, minX, maxX, type);
+    }
+  }
+  if (changed) {
+    wakeArea(bounds.minX, bounds.minY, bounds.maxX, bounds.maxY);
+  }
+}
+
+// Paint a width wide square at every cell of Bresenham's line. The squares
+// of the cells within half a width of a row cover one span of it, from the
+// leftmost of those cells to the rightmost. The line's x only ever moves one
+// way, so those are on the first and last line row within reach, and every row
+// is painted once however many squares cover it
+static void paintLine(const world_edit *edit) {
+  int half = edit->width / 2;
+  // Leftmost and rightmost cell of the line on each row from -half to
+  // height - 1 + half, the rows whose squares reach into the world
+  int rows = _state.height + 2 * half;
+  int *lineMinX = malloc((size_t)rows * 2 * sizeof(int));
+  if (lineMinX == NULL) {
+    return;
+  }
+  int *lineMaxX = lineMinX + rows;
+  int firstRow = INT_MAX;
+  int lastRow = INT_MIN;
+
+  int x = edit->x0;
+  int y = edit->y0;
+  int dx = abs(edit->x1 - x);
+  int dy = -abs(edit->y1 - y);
+  int stepX = x < edit->x1 ? 1 : -1;
+  int stepY = y < edit->y1 ? 1 : -1;
+  int error = dx + dy;
+  for (;;) {
+    int row = y + half;
+    if (row >= 0 && row < rows) {
+      if (row < firstRow || row > lastRow) {
+        lineMinX[row] = lineMaxX[row] = x;
+      }
+      lineMinX[row] = min(lineMinX[row], x);
+      lineMaxX[row] = max(lineMaxX[row], x);
+      firstRow = min(firstRow, row);
+      lastRow = max(lastRow, row);
+    }
+    if (x == edit->x1 && y == edit->y1) {
+      break;
+    }
+    int error2 = error * 2;
+    if (error2 >= dy) {
+      error += dy;
+      x += stepX;
+    }
+    if (error2 <= dx) {
+      error += dx;
+      y += stepY;
+    }
+  }
+
+  // Rows are counted from -half, so the line rows within reach of row y are
+  // y to y + 2 * half
+  cell_rect bounds = EMPTY_RECT;
+  for (y = max(firstRow - 2 * half, 0);
+       y <= min(lastRow, _state.height - 1); y++) {
+    int first = max(y, firstRow);
+    int last = min(y + 2 * half, lastRow);
+    int minX = max(min(lineMinX[first], lineMinX[last]) - half, 0);
+    int maxX =
+        min(max(lineMaxX[first], lineMaxX[last]) + half, _state.width - 1);
+    if (minX <= maxX && paintSpan(y, minX, maxX, edit->blockType)) {
+      bounds = (cell_rect){.minX = min(bounds.minX, minX),
+                           .minY = min(bounds.minY, y),
+                           .maxX = max(bounds.maxX, maxX),
+                           .maxY = max(bounds.maxY, y)};
+    }
+  }
+  free(lineMinX);
+  if (bounds.minX <= bounds.maxX) {
+    wakeArea(bounds.minX, bounds.minY, bounds.maxX, bounds.maxY);
+  }
+}
+
+static void replaceType(const world_edit *edit) {
+  if (edit->fromType == edit->blockType) {
+    return;
+  }
+  cell_rect rect = clipRect(edit->x0, edit->y0, edit->x1, edit->y1);
+  bool changed = false;
+  for (int y = rect.minY; y <= rect.maxY; y++) {
+    Block *row = &_state.world[(size_t)y * _state.width];
+    bool rowChanged = false;
+    for (int x = rect.minX; x <= rect.maxX; x++) {
+      if (row[x].type == edit->fromType) {
+        row[x] = NewBlock(edit->blockType);
+        rowChanged = true;
+      }
+    }
+    if (rowChanged) {
+      rebuildPlaneSpan(y, rect.minX, rect.maxX);
+      changed = true;
+    }
+  }
+  if (changed) {
+    wakeArea(rect.minX, rect.minY, rect.maxX, rect.maxY);
+  }
+}
+
+// Whether a type bounds the regions of EDIT_REPLACE_REGION
+static bool isWall(uint8_t type) { return BLOCKS[type].props == NO_PROPS; }
+
+typedef struct {
+  int x;
+  int y;
+} seed;
+
+typedef struct {
+  const world_edit *edit;
+  uint8_t startType;
+  // One bit per cell of the world, set once a cell is part of a span. Only
+  // needed when replacing, a fill changes every cell it visits so they leave
+  // the region by themselves
+  uint64_t *visited;
+  seed *seeds;
+  size_t count;
+  size_t capacity;
+  cell_rect bounds;
+} flood;
+
+// Whether cell x of the row starting at cell offset still has to be flooded
+static inline bool canFlood(const flood *f, size_t offset, int x) {
+  uint8_t type = _state.world[offset + x].type;
+  if (f->visited == NULL) {
+    return type == f->startType;
+  }
+  size_t index = offset + x;
+  return !((f->visited[index / 64] >> (index % 64)) & 1) && !isWall(type);
+}
+
+static bool pushSeed(flood *f, int x, int y) {
+  if (f->count == f->capacity) {
+    size_t capacity = f->capacity * 2;
+    seed *seeds = realloc(f->seeds, capacity * sizeof(seed));
+    if (seeds == NULL) {
+      return false;
+    }
+    f->seeds = seeds;
+    f->capacity = capacity;
+  }
+  f->seeds[f->count++] = (seed){x, y};
+  return true;
+}
+
+// Push a seed for the start of every run of cells to flood in minX to maxX of
+// row y
+static bool pushRuns(flood *f, int y, int minX, int maxX) {
+  if (y < 0 || y >= _state.height) {
+    return true;
+  }
+  size_t offset = (size_t)y * _state.width;
+  bool inRun = false;
+  for (int x = minX; x <= maxX; x++) {
+    bool can = canFlood(f, offset, x);
+    if (can && !inRun && !pushSeed(f, x, y)) {
+      return false;
+    }
+    inRun = can;
+  }
+  return true;
+}
+
+// Set the bits of cells first to last in the bitmap
+static void setBits(uint64_t *bits, size_t first, size_t last) {
+  for (size_t w = first / 64; w <= last / 64; w++) {
+    uint64_t mask = ~0ULL;
+    if (w == first / 64) {
+      mask &= ~0ULL << (first % 64);
+    }
+    if (w == last / 64) {
+      mask &= ~0ULL >> (63 - last % 64);
+    }
+    bits[w] |= mask;
+  }
+}
+
+// Apply the edit to the span and mark it as visited
+static void floodSpan(flood *f, int y, int minX, int maxX) {
+  const world_edit *edit = f->edit;
+  size_t offset = (size_t)y * _state.width;
+  Block *row = &_state.world[offset];
+  bool changed = true;
+  if (f->visited == NULL) {
+    NewBlocks(&row[minX], maxX - minX + 1, edit->blockType);
+    setPlaneSpan(y, minX, maxX, edit->blockType);
+  } else {
+    setBits(f->visited, offset + minX, offset + maxX);
+    changed = false;
+    for (int x = minX; x <= maxX; x++) {
+      if (row[x].type != edit->fromType) {
+        continue;
+      }
+      int end = x;
+      while (end < maxX && row[end + 1].type == edit->fromType) {
+        end++;
+      }
+      NewBlocks(&row[x], end - x + 1, edit->blockType);
+      changed = true;
+      x = end;
+    }
+    if (changed) {
+      rebuildPlaneSpan(y, minX, maxX);
+    }
+  }
+  if (changed) {
+    f->bounds = (cell_rect){.minX = min(f->bounds.minX, minX),
+                            .minY = min(f->bounds.minY, y),
+                            .maxX = max(f->bounds.maxX, maxX),
+                            .maxY = max(f->bounds.maxY, y)};
+  }
+}
+
+// Scanline flood fill with an explicit stack of seeds. Each seed is grown
+// into the widest span of its row, which is edited as a whole, and the rows
+// above and below the span are searched for runs to seed next. Every cell is
+// visited a bounded number of times however large the region is
+static void floodRegion(const world_edit *edit) {
+  Block *start = getBlock(edit->x0, edit->y0);
+  if (start == NULL) {
+    return;
+  }
+  bool fill = edit->type == EDIT_FILL;
+  if (fill ? start->type == edit->blockType
+           : edit->fromType == edit->blockType || isWall(start->type)) {
+    return;
+  }
+
+  flood f = {.edit = edit,
+             .startType = start->type,
+             .capacity = 64,
+             .bounds = EMPTY_RECT};
+  size_t cells = (size_t)_state.width * _state.height;
+  f.seeds = malloc(f.capacity * sizeof(seed));
+  bool ok = f.seeds != NULL;
+  if (ok && !fill) {
+    f.visited = calloc((cells + 63) / 64, sizeof(uint64_t));
+    ok = f.visited != NULL;
+  }
+  ok = ok && pushSeed(&f, edit->x0, edit->y0);
+
+  while (ok && f.count > 0) {
+    seed s = f.seeds[--f.count];
+    size_t offset = (size_t)s.y * _state.width;
+    if (!canFlood(&f, offset, s.x)) {
+      continue;
+    }
+    int minX = s.x;
+    while (minX > 0 && canFlood(&f, offset, minX - 1)) {
+      minX--;
+    }
+    int maxX = s.x;
+    while (maxX < _state.width - 1 && canFlood(&f, offset, maxX + 1)) {
+      maxX++;
+    }
+    floodSpan(&f, s.y, minX, maxX);
+    ok = pushRuns(&f, s.y - 1, minX, maxX) &&
+         pushRuns(&f, s.y + 1, minX, maxX);
+  }
+
+  // Running out of memory leaves the region partly edited, which is still a
+  // consistent world
+  if (f.bounds.minX <= f.bounds.maxX) {
+    wakeArea(f.bounds.minX, f.bounds.minY, f.bounds.maxX, f.bounds.maxY);
+  }
+  free(f.visited);
+  free(f.seeds);
+}
+
+void applyEdit(const world_edit *edit) {
+  switch (edit->type) {
+  case EDIT_RECT:
+    paintRect(clipRect(edit->x0, edit->y0, edit->x1, edit->y1),
+              edit->blockType);
+    break;
+  case EDIT_CIRCLE:
+    paintCircle(edit->x0, edit->y0, edit->width, edit->blockType);
+    break;
+  case EDIT_LINE:
+    paintLine(edit);
+    break;
+  case EDIT_REPLACE:
+    replaceType(edit);
+    break;
+  case EDIT_FILL:
+  case EDIT_REPLACE_REGION:
+    floodRegion(edit);
+    break;
+  default:
+    break;
+  }
+}
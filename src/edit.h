@@ -0,0 +1,48 @@
+#pragma once
+
+#include "block.h"
+#include <stdbool.h>
+
+// Edits to the world made from outside of the tick, like painting with the
+// brush. An edit clips its area to the world once, writes whole row spans and
+// then updates the planes and wakes the area in one go. Cells that already
+// have the painted type are left alone so their colour does not change.
+//
+// Edits are plain values so they can be queued for the simulation thread and
+// written to recordings, and applied between ticks.
+
+typedef enum {
+  // Fill the rectangle between (x0, y0) and (x1, y1) inclusive
+  EDIT_RECT,
+  // Fill the circle with a diameter of width centred on (x0, y0)
+  EDIT_CIRCLE,
+  // Paint a width wide square at every cell of the line from (x0, y0) to
+  // (x1, y1), so a fast brush stroke leaves no gaps
+  EDIT_LINE,
+  // Turn the cells of fromType in the rectangle between (x0, y0) and (x1, y1)
+  // into blockType
+  EDIT_REPLACE,
+  // Fill the 4-connected region of cells with the same type as (x0, y0)
+  EDIT_FILL,
+  // Turn the cells of fromType into blockType inside the 4-connected region
+  // of (x0, y0) bounded by walls, materials that never move like rock
+  EDIT_REPLACE_REGION,
+  EDIT_TYPES_COUNT
+} edit_type;
+
+typedef struct {
+  edit_type type;
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+  int width;
+  enum BlockType blockType;
+  enum BlockType fromType;
+} world_edit;
+
+// Whether the edit's fields are in range, for edits read from files.
+// Coordinates may lie outside of the world by up to the largest world size
+bool isValidEdit(const world_edit *edit);
+
+void applyEdit(const world_edit *edit);
@@ -0,0 +1,479 @@
+#include "journal.h"
+#include "block.h"
+#include "changes.h"
+#include "chunk.h"
+#include "consts.h"
+#include "planes.h"
+#include "rng.h"
+#include "state.h"
+#include "stream.h"
+#include "utils.h"
+#include "world.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A chunk as it was at the start of a step. Chunks are kept by their map
+// position, so the steps still apply after the window scrolls
+typedef struct {
+  int mx;
+  int my;
+  // The cells saved, in map cells. Only the part of the chunk that was in the
+  // window, the cells outside it never change
+  cell_rect rect;
+  // The cells row by row, or NULL when they are all the same as cell
+  Block *cells;
+  Block cell;
+} saved_chunk;
+
+typedef struct {
+  // Game state at the checkpoint that started the step
+  uint64_t tick;
+  uint64_t seed;
+  uint64_t rng;
+  saved_chunk *chunks;
+  int count;
+  int capacity;
+  // Memory held by the chunks, counted against the budget
+  size_t bytes;
+} journal_step;
+
+// Steps in the order they were made, the next one to undo or redo last
+typedef struct {
+  journal_step *steps;
+  int count;
+  int capacity;
+} step_list;
+
+static struct {
+  bool enabled;
+  size_t budget;
+  // Memory held by every step
+  size_t used;
+  // The world as of the last sync, stored like the world
+  Block *copy;
+  // Where the sync is in the list of changes
+  change_cursor changes;
+  // Whether each chunk is already saved in the open step
+  bool *saved;
+  // The step the changes are currently saved to
+  journal_step open;
+  // Set when the open step had to be dropped to stay in the budget. Nothing is
+  // saved until the next checkpoint, which can't be returned to
+  bool lost;
+  step_list undo;
+  step_list redo;
+} journal;
+
+// Bounds of the chunk, clipped to the world
+static cell_rect chunkBounds(int index) {
+  int minX = index % _state.chunksX * CHUNK_SIZE;
+  int minY = index / _state.chunksX * CHUNK_SIZE;
+  return (cell_rect){.minX = minX,
+                     .minY = minY,
+                     .maxX = min(minX + CHUNK_SIZE, _state.width) - 1,
+                     .maxY = min(minY + CHUNK_SIZE, _state.height) - 1};
+}
+
+// The rect of map cells moved into the window and clipped to it. Empty when
+// it is outside
+static cell_rect windowRect(const cell_rect *rect) {
+  int offsetX = _state.originX * CHUNK_SIZE;
+  int offsetY = _state.originY * CHUNK_SIZE;
+  return (cell_rect){.minX = max(rect->minX - offsetX, 0),
+                     .minY = max(rect->minY - offsetY, 0),
+                     .maxX = min(rect->maxX - offsetX, _state.width - 1),
+                     .maxY = min(rect->maxY - offsetY, _state.height - 1)};
+}
+
+// Index of the saved chunk in the window. Only valid for the open step, as the
+// window never moves while one is open
+static int windowIndex(const saved_chunk *saved) {
+  return (saved->my - _state.originY) * _state.chunksX +
+         (saved->mx - _state.originX);
+}
+
+// Copy the rect between two arrays stored like the world
+static void copyRect(Block *to, const Block *from, const cell_rect *bounds) {
+  size_t width = bounds->maxX - bounds->minX + 1;
+  for (int y = bounds->minY; y <= bounds->maxY; y++) {
+    size_t offset = (size_t)y * _state.width + bounds->minX;
+    memcpy(&to[offset], &from[offset], width * sizeof(Block));
+  }
+}
+
+// Every bit of a block is a stored field, so blocks can be compared as bytes
+static bool sameRect(const Block *a, const Block *b, const cell_rect *bounds) {
+  size_t width = bounds->maxX - bounds->minX + 1;
+  for (int y = bounds->minY; y <= bounds->maxY; y++) {
+    size_t offset = (size_t)y * _state.width + bounds->minX;
+    if (memcmp(&a[offset], &b[offset], width * sizeof(Block)) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool isUniform(const Block *cells, int stride, int width,
+                      int height) {
+  for (int y = 0; y < height; y++) {
+    const Block *row = &cells[(size_t)y * stride];
+    for (int x = 0; x < width; x++) {
+      if (memcmp(&row[x], &cells[0], sizeof(Block)) != 0) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static void freeStep(journal_step *step) {
+  for (int i = 0; i < step->count; i++) {
+    free(step->chunks[i].cells);
+  }
+  free(step->chunks);
+  journal.used -= step->bytes;
+  *step = (journal_step){0};
+}
+
+static void freeSteps(step_list *list) {
+  for (int i = 0; i < list->count; i++) {
+    freeStep(&list->steps[i]);
+  }
+  list->count = 0;
+}
+
+// An empty step starting at the current game state
+static journal_step newStep(void) {
+  return (journal_step){
+      .tick = _state.tick, .seed = _state.seed, .rng = state};
+}
+
+// Add the rect of map cells of chunk (mx, my) to the step, from cells that
+// start at its first cell and are stride cells apart from one row to the
+// next. Returns false if there is no memory for it
+static bool saveChunk(journal_step *step, int mx, int my,
+                      const cell_rect *rect, const Block *cells, int stride) {
+  if (step->count == step->capacity) {
+    int capacity = max(step->capacity * 2, 16);
+    saved_chunk *chunks =
+        realloc(step->chunks, (size_t)capacity * sizeof(saved_chunk));
+    if (chunks == NULL) {
+      return false;
+    }
+    step->chunks = chunks;
+    step->capacity = capacity;
+  }
+
+  int width = rect->maxX - rect->minX + 1;
+  int height = rect->maxY - rect->minY + 1;
+  saved_chunk saved = {.mx = mx, .my = my, .rect = *rect, .cell = cells[0]};
+  size_t bytes = sizeof(saved_chunk);
+  if (!isUniform(cells, stride, width, height)) {
+    saved.cells = malloc((size_t)width * height * sizeof(Block));
+    if (saved.cells == NULL) {
+      return false;
+    }
+    for (int y = 0; y < height; y++) {
+      memcpy(&saved.cells[y * width], &cells[(size_t)y * stride],
+             width * sizeof(Block));
+    }
+    bytes += (size_t)width * height * sizeof(Block);
+  }
+  step->chunks[step->count++] = saved;
+  step->bytes += bytes;
+  journal.used += bytes;
+  return true;
+}
+
+// Save chunk index of the window, as it is in the copy
+static bool saveWindowChunk(journal_step *step, int index) {
+  cell_rect bounds = chunkBounds(index);
+  int offsetX = _state.originX * CHUNK_SIZE;
+  int offsetY = _state.originY * CHUNK_SIZE;
+  cell_rect rect = {.minX = bounds.minX + offsetX,
+                    .minY = bounds.minY + offsetY,
+                    .maxX = bounds.maxX + offsetX,
+                    .maxY = bounds.maxY + offsetY};
+  return saveChunk(
+      step, _state.originX + index % _state.chunksX,
+      _state.originY + index / _state.chunksX, &rect,
+      &journal.copy[(size_t)bounds.minY * _state.width + bounds.minX],
+      _state.width);
+}
+
+// Whether the saved rect is all in the window, so none of it is stored
+static bool inWindow(const saved_chunk *saved) {
+  cell_rect window = windowRect(&saved->rect);
+  return window.maxX - window.minX == saved->rect.maxX - saved->rect.minX &&
+         window.maxY - window.minY == saved->rect.maxY - saved->rect.minY;
+}
+
+// Read the saved chunk's cells as they are now into cells, CHUNK_SIZE rows of
+// CHUNK_SIZE, from the store and the world
+static void readChunk(const saved_chunk *saved, Block *cells) {
+  if (!inWindow(saved)) {
+    streamReadChunk(saved->mx, saved->my, cells);
+  }
+  cell_rect window = windowRect(&saved->rect);
+  int width = window.maxX - window.minX + 1;
+  int offsetX = _state.originX * CHUNK_SIZE - saved->mx * CHUNK_SIZE;
+  int offsetY = _state.originY * CHUNK_SIZE - saved->my * CHUNK_SIZE;
+  for (int y = window.minY; width > 0 && y <= window.maxY; y++) {
+    memcpy(&cells[(y + offsetY) * CHUNK_SIZE + window.minX + offsetX],
+           &_state.world[(size_t)y * _state.width + window.minX],
+           width * sizeof(Block));
+  }
+}
+
+// The saved cell at map cell (x, y) of its rect
+static Block savedCell(const saved_chunk *saved, int x, int y) {
+  if (saved->cells == NULL) {
+    return saved->cell;
+  }
+  int width = saved->rect.maxX - saved->rect.minX + 1;
+  return saved->cells[(y - saved->rect.minY) * width + x - saved->rect.minX];
+}
+
+// Put the chunk back in the world and the copy and wake it, and in the store
+// where it is outside the window
+static void restoreChunk(const saved_chunk *saved) {
+  int offsetX = _state.originX * CHUNK_SIZE;
+  int offsetY = _state.originY * CHUNK_SIZE;
+  cell_rect window = windowRect(&saved->rect);
+  bool shown = window.minX <= window.maxX && window.minY <= window.maxY;
+  for (int y = window.minY; shown && y <= window.maxY; y++) {
+    Block *row = &_state.world[(size_t)y * _state.width];
+    for (int x = window.minX; x <= window.maxX; x++) {
+      row[x] = savedCell(saved, x + offsetX, y + offsetY);
+    }
+    rebuildPlaneSpan(y, window.minX, window.maxX);
+  }
+  if (shown) {
+    copyRect(journal.copy, _state.world, &window);
+    wakeArea(window.minX, window.minY, window.maxX, window.maxY);
+  }
+
+  if (!inWindow(saved)) {
+    Block cells[CHUNK_SIZE * CHUNK_SIZE];
+    streamReadChunk(saved->mx, saved->my, cells);
+    for (int y = saved->rect.minY; y <= saved->rect.maxY; y++) {
+      for (int x = saved->rect.minX; x <= saved->rect.maxX; x++) {
+        cells[(y - saved->my * CHUNK_SIZE) * CHUNK_SIZE + x -
+              saved->mx * CHUNK_SIZE] = savedCell(saved, x, y);
+      }
+    }
+    streamWriteChunk(saved->mx, saved->my, cells);
+  }
+}
+
+// Drop the open step. The undo steps go with it, as undoing them without the
+// chunks it saved would leave those chunks as they are now, in a world that
+// never was
+static void loseOpenStep(void) {
+  for (int i = 0; i < journal.open.count; i++) {
+    journal.saved[windowIndex(&journal.open.chunks[i])] = false;
+  }
+  freeStep(&journal.open);
+  freeSteps(&journal.undo);
+  journal.lost = true;
+}
+
+// Drop the oldest undo steps, then the redo steps and as a last resort the open
+// step until the history fits in the budget
+static void enforceBudget(void) {
+  int dropped = 0;
+  while (journal.used > journal.budget && dropped < journal.undo.count) {
+    freeStep(&journal.undo.steps[dropped++]);
+  }
+  if (dropped > 0) {
+    journal.undo.count -= dropped;
+    memmove(journal.undo.steps, journal.undo.steps + dropped,
+            (size_t)journal.undo.count * sizeof(journal_step));
+  }
+  if (journal.used > journal.budget) {
+    freeSteps(&journal.redo);
+  }
+  if (journal.used > journal.budget) {
+    loseOpenStep();
+  }
+}
+
+// Add the step to the end of the list. If there is no memory the step is freed
+// along with the whole list, whose steps only lead back to a real world
+// through it
+static void pushStep(step_list *list, journal_step *step) {
+  if (list->count == list->capacity) {
+    int capacity = max(list->capacity * 2, 16);
+    journal_step *steps =
+        realloc(list->steps, (size_t)capacity * sizeof(journal_step));
+    if (steps == NULL) {
+      freeStep(step);
+      freeSteps(list);
+      return;
+    }
+    list->steps = steps;
+    list->capacity = capacity;
+  }
+  list->steps[list->count++] = *step;
+}
+
+// Save the chunk to the open step the first time it changes in the step and
+// bring the copy up to date
+static void syncChunk(int index) {
+  cell_rect bounds = chunkBounds(index);
+  if (sameRect(journal.copy, _state.world, &bounds)) {
+    return;
+  }
+  // The world moved on from where the undone steps left it
+  freeSteps(&journal.redo);
+  if (!journal.lost && !journal.saved[index]) {
+    if (saveWindowChunk(&journal.open, index)) {
+      journal.saved[index] = true;
+      enforceBudget();
+    } else {
+      loseOpenStep();
+    }
+  }
+  copyRect(journal.copy, _state.world, &bounds);
+}
+
+bool journalInit(size_t budget) {
+  freeStep(&journal.open);
+  freeSteps(&journal.undo);
+  freeSteps(&journal.redo);
+  free(journal.copy);
+  free(journal.saved);
+  journal.copy = NULL;
+  journal.saved = NULL;
+  journal.enabled = false;
+
+  size_t cells = (size_t)_state.width * _state.height;
+  size_t chunks = (size_t)_state.chunksX * _state.chunksY;
+  journal.copy = malloc(cells * sizeof(Block));
+  journal.saved = calloc(chunks, sizeof(bool));
+  if (journal.copy == NULL || journal.saved == NULL) {
+    free(journal.copy);
+    free(journal.saved);
+    journal.copy = NULL;
+    journal.saved = NULL;
+    return false;
+  }
+  memcpy(journal.copy, _state.world, cells * sizeof(Block));
+  journal.changes = changesSubscribe();
+  journal.budget = budget;
+  journal.used = 0;
+  journal.lost = false;
+  journal.open = newStep();
+  journal.enabled = true;
+  return true;
+}
+
+void journalClear(void) {
+  if (journal.enabled) {
+    journalInit(journal.budget);
+  }
+}
+
+void journalWindowMoved(void) {
+  if (!journal.enabled) {
+    return;
+  }
+  memcpy(journal.copy, _state.world,
+         (size_t)_state.width * _state.height * sizeof(Block));
+  journal.changes = changesSubscribe();
+}
+
+static void syncAll(void) {
+  int count = _state.chunksX * _state.chunksY;
+  for (int i = 0; i < count; i++) {
+    syncChunk(i);
+  }
+}
+
+void journalSync(void) {
+  if (!journal.enabled) {
+    return;
+  }
+  world_change changes[CHANGE_BATCH];
+  int count;
+  while ((count = changesRead(&journal.changes, changes, CHANGE_BATCH)) != 0) {
+    if (count < 0) {
+      syncAll();
+    }
+    for (int i = 0; i < count; i++) {
+      syncChunk(changes[i].chunk);
+    }
+  }
+}
+
+void journalTick(void) {
+  journalSync();
+  if (_state.tick % HISTORY_STEP_TICKS == 0) {
+    journalCheckpoint();
+  }
+}
+
+void journalCheckpoint(void) {
+  if (!journal.enabled) {
+    return;
+  }
+  journalSync();
+  for (int i = 0; i < journal.open.count; i++) {
+    journal.saved[windowIndex(&journal.open.chunks[i])] = false;
+  }
+  if (journal.open.count > 0) {
+    pushStep(&journal.undo, &journal.open);
+  }
+  journal.lost = false;
+  journal.open = newStep();
+}
+
+// Undo or redo the last step of from, moving it to to as the step that
+// reverses it
+static bool reverseStep(step_list *from, step_list *to) {
+  if (!journal.enabled) {
+    return false;
+  }
+  // Closes the open step, so the chunks outside of the step being reversed
+  // are the same as at its start
+  journalCheckpoint();
+  if (from->count == 0) {
+    return false;
+  }
+
+  journal_step step = from->steps[--from->count];
+  journal_step reverse = newStep();
+  bool saved = true;
+  for (int i = 0; saved && i < step.count; i++) {
+    const saved_chunk *chunk = &step.chunks[i];
+    Block cells[CHUNK_SIZE * CHUNK_SIZE];
+    readChunk(chunk, cells);
+    int first = (chunk->rect.minY - chunk->my * CHUNK_SIZE) * CHUNK_SIZE +
+                chunk->rect.minX - chunk->mx * CHUNK_SIZE;
+    saved = saveChunk(&reverse, chunk->mx, chunk->my, &chunk->rect,
+                      &cells[first], CHUNK_SIZE);
+  }
+  if (saved) {
+    pushStep(to, &reverse);
+  } else {
+    freeStep(&reverse);
+    freeSteps(to);
+  }
+
+  for (int i = 0; i < step.count; i++) {
+    restoreChunk(&step.chunks[i]);
+  }
+  _state.tick = step.tick;
+  _state.seed = step.seed;
+  state = step.rng;
+  freeStep(&step);
+
+  journal.open = newStep();
+  enforceBudget();
+  return true;
+}
+
+bool journalUndo(void) { return reverseStep(&journal.undo, &journal.redo); }
+
+bool journalRedo(void) { return reverseStep(&journal.redo, &journal.undo); }
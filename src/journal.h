@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Undo and redo history of the world. The history is a list of steps, each
+// holding the chunks that changed since the checkpoint that started it as they
+// were at that checkpoint, along with the tick, seed and RNG state at the
+// time. Undoing a step puts those chunks back, which returns the whole world to
+// the checkpoint, and keeps the chunks it replaced so the step can be redone.
+//
+// Changes are found after the fact from the list in changes.h: after each tick
+// and each batch of edits the chunks it lists are compared with a copy of the
+// world kept by the journal and the ones that differ are saved once per step.
+// Only the copy is the size of the world, the steps hold just the chunks that
+// changed and a chunk whose cells are all the same is kept as a single cell.
+//
+// Chunks are kept by their position in the map, see stream.h, so the history
+// survives scrolling the window. Undoing a step puts the chunks that left the
+// window back in the chunk store.
+//
+// Redo is only possible until the world changes again, so a step that was
+// undone while the simulation runs is gone as soon as something moves.
+//
+// Every function does nothing until journalInit succeeds.
+
+// Start an empty history for the current world, which may use up to budget
+// bytes for the steps before the oldest ones are dropped. Call it again after
+// the world is replaced some other way, like loading a game. Returns false
+// and turns the history off if the copy of the world can't be allocated
+bool journalInit(size_t budget);
+
+// Drop the whole history, for changes that can't be undone
+void journalClear(void);
+
+// Take the world as it is after the window moved, without saving it as a
+// change. Call journalCheckpoint before moving it, so no step is left open
+// across the move
+void journalWindowMoved(void);
+
+// Save the chunks changed since the last call. Call after every batch of edits
+void journalSync(void);
+
+// Save the chunks changed by the last tick and start a new step every
+// HISTORY_STEP_TICKS ticks. Call after every tick
+void journalTick(void);
+
+// Start a new step at the current world, so it can be returned to with undo
+void journalCheckpoint(void);
+
+// Return the world to the start of the last step. Returns false if there is
+// nothing to undo
+bool journalUndo(void);
+
+// Return the world to where it was before the last undo. Returns false if
+// there is nothing to redo
+bool journalRedo(void);
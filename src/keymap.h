@@ -8,4 +8,22 @@ static const KeyboardKey SELECTED_BLOCK_RIGHT = KEY_D;
 static const KeyboardKey INCREASE_PLACE_WIDTH = KEY_EQUAL;
 static const KeyboardKey DECREASE_PLACE_WIDTH = KEY_MINUS;
 
+static const KeyboardKey SWITCH_TOOL = KEY_T;
+
+static const KeyboardKey UNDO_KEY = KEY_Z;
+static const KeyboardKey REDO_KEY = KEY_Y;
+
+// Move the world through the map by a chunk
+static const KeyboardKey SCROLL_LEFT = KEY_LEFT;
+static const KeyboardKey SCROLL_RIGHT = KEY_RIGHT;
+static const KeyboardKey SCROLL_UP = KEY_UP;
+static const KeyboardKey SCROLL_DOWN = KEY_DOWN;
+
+// The mouse wheel zooms the camera and dragging with this button pans it
+static const MouseButton PAN_BUTTON = MOUSE_BUTTON_RIGHT;
+static const KeyboardKey RESET_VIEW_KEY = KEY_HOME;
+
 static const KeyboardKey MAIN_MENU_KEY = KEY_ESCAPE;
+
+// Only does anything in builds with PROFILE defined
+static const KeyboardKey PROFILE_OVERLAY_KEY = KEY_F3;
@@ -2,17 +2,26 @@
 // falling
 
 #include <err.h>
+#include <math.h>
 #include <raylib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "block.h"
 #include "consts.h"
+#include "journal.h"
 #include "keymap.h"
+#include "profile.h"
+#include "record.h"
+#include "render.h"
 #include "rng.h"
+#include "sim.h"
+#include "snapshot.h"
 #include "state.h"
+#include "stream.h"
 #include "ui.h"
 #include "utils.h"
 #include "world.h"
@@ -33,78 +42,51 @@ void ProcessKeys(game_state *state) {
     // Make sure placeWidth is always odd. We want to limit the place width to
     // the screen size
     state->placeWidth = min(state->placeWidth + 2,
-                            EnsureOdd(min(WORLD_WIDTH, WORLD_HEIGHT) - 1));
+                            EnsureOdd(min(state->width, state->height) - 1));
   } else if (IsKeyPressed(DECREASE_PLACE_WIDTH)) {
     state->placeWidth = max(state->placeWidth - 2, 1);
   }
-}
-
-void drawWorld(game_state *state, int mouseX, int mouseY) {
 
-  // Draw the blocks on the screen
-  for (int y = 0; y < WORLD_HEIGHT; y++) {
-    int screenY = (WORLD_HEIGHT - y - 1) * PX_SCALE + WORLD_SCREEN_TOP_LEFT_Y;
-    for (int x = 0; x < WORLD_WIDTH; x++) {
-
-      int screenX = x * PX_SCALE + WORLD_SCREEN_TOP_LEFT_X;
-
-      Block *block = getBlock(x, y);
-      switch (block->type) {
-      case AIR:
-        break;
-      case SAND:
-      case GRAVEL:
-      case ROCK:
-      case WATER:
-      case SMOKE:
-        DrawRectangle(screenX, screenY, PX_SCALE, PX_SCALE, block->color);
-        break;
-      default:
-        // This branch should never be reached
-        fprintf(stderr,
-                "Found invalid block type %d at position (%d, %d) which "
-                "should never happen\n",
-                block->type, x, y);
-        // If we can't find the block, draw a checker board
-        int size = PX_SCALE / 2;
-        Color dark_blue = (Color){.r = 0, .g = 14, .b = 36, .a = 255};
-        DrawRectangle(screenX + size, screenY, size, size, dark_blue);
-        DrawRectangle(screenX + size, screenY + size, size, size, PURPLE);
-        DrawRectangle(screenX, screenY, size, size, PURPLE);
-        DrawRectangle(screenX, screenY + size, size, size, dark_blue);
-        break;
-      }
-    }
+  if (IsKeyPressed(SWITCH_TOOL)) {
+    state->tool = (state->tool + 1) % TOOLS_COUNT;
   }
+}
 
-  // Draw grid
-  for (int y = 0; y < WORLD_HEIGHT + 1; y++) {
-    DrawLine(WORLD_SCREEN_TOP_LEFT_X, y * PX_SCALE + WORLD_SCREEN_TOP_LEFT_Y,
-             WORLD_SCREEN_BOTTOM_RIGHT_X,
-             y * PX_SCALE + WORLD_SCREEN_TOP_LEFT_Y, GRID_LINE_COLOR);
-  }
+// Fill or replace with the selected type in the region of the clicked cell.
+// The type being replaced is read from the latest frame
+static void pushRegionEdit(const game_state *state, int x, int y) {
+  const world_frame *frame = simLatestFrame();
+  uint8_t clicked = frame->cells[(size_t)y * frame->width + x].type;
+  simPush(&(sim_command){
+      .type = SIM_EDIT,
+      .edit = {.type = state->tool == TOOL_FILL ? EDIT_FILL
+                                                : EDIT_REPLACE_REGION,
+               .x0 = x,
+               .y0 = y,
+               .x1 = x,
+               .y1 = y,
+               .width = 1,
+               .blockType = state->selectedBlockType,
+               .fromType = clicked}});
+}
 
-  for (int x = 0; x < WORLD_WIDTH + 1; x++) {
-    DrawLine(x * PX_SCALE + WORLD_SCREEN_TOP_LEFT_X, WORLD_SCREEN_TOP_LEFT_Y,
-             x * PX_SCALE + WORLD_SCREEN_TOP_LEFT_X,
-             WORLD_SCREEN_BOTTOM_RIGHT_Y, GRID_LINE_COLOR);
-  }
+void drawWorld(game_state *state, int mouseX, int mouseY) {
+
+  // Draw the blocks and the grid in view on the screen
+  drawWorldTexture(simLatestFrame());
 
   // TODO: Fix the weird mouse bug where moving the mouse past the left
   // window border will blink a box near the right window border for a brief
   // moment
 
   // Render cursor outline on screen
-  if (mouseX >= WORLD_SCREEN_TOP_LEFT_X && mouseY >= WORLD_SCREEN_TOP_LEFT_Y &&
-      mouseX < WORLD_SCREEN_BOTTOM_RIGHT_X &&
-      mouseY < WORLD_SCREEN_BOTTOM_RIGHT_Y) {
-    int screenX = ((int)mouseX / PX_SCALE) * PX_SCALE;
-    int screenY = ((int)mouseY / PX_SCALE) * PX_SCALE;
-
-    DrawRectangleLines(screenX - (state->placeWidth - 1) / 2 * PX_SCALE,
-                       screenY - (state->placeWidth - 1) / 2 * PX_SCALE,
-                       PX_SCALE * state->placeWidth,
-                       PX_SCALE * state->placeWidth, RAYWHITE);
+  int x, y;
+  if (screenToCell(mouseX, mouseY, &x, &y)) {
+    // The region tools only act on the clicked cell
+    int half = state->tool == TOOL_BRUSH ? (state->placeWidth - 1) / 2 : 0;
+    Rectangle outline = cellsToScreen(x - half, y - half, x + half, y + half);
+    DrawRectangleLines(outline.x, outline.y, outline.width, outline.height,
+                       RAYWHITE);
   }
 }
 
@@ -145,7 +127,10 @@ void DrawButton(int x, int y, int width, int height, const char *text,
 }
 
 void newGameButtonAction(menu *currentMenu) {
+  // The simulation is inactive while the menu is shown
+  recordEvent(EVENT_NEW_GAME, 0);
   initGameState();
+  simWorldReplaced();
   *currentMenu = GAME_SCREEN;
 }
 
@@ -155,9 +140,58 @@ void openSettingsButtonAction(menu *currentMenu) {
   *currentMenu = SETTINGS_MENU;
 }
 
+// Recreate everything drawn at the world size after it changed
+static void resizeDisplay() {
+  unloadRenderer();
+  initLayout(_state.width, _state.height);
+  SetWindowSize(layout.screenWidth, layout.screenHeight);
+  if (!initRenderer()) {
+    fprintf(stderr, "Failed to create the world texture\n");
+    exit(1);
+  }
+}
+
+void saveGameButtonAction(menu *currentMenu) {
+  (void)currentMenu;
+  if (!saveGame(SAVE_FILE)) {
+    fprintf(stderr, "Failed to save the game to %s\n", SAVE_FILE);
+  }
+}
+
+// A recording can't be replayed past a load, so it ends at the tick the game
+// was at before the load
+static void endRecordingForLoad(void) {
+  if (isRecording()) {
+    fprintf(stderr, "Loading a game ends the recording\n");
+    stopRecording();
+  }
+}
+
+void loadGameButtonAction(menu *currentMenu) {
+  int oldWidth = _state.width;
+  int oldHeight = _state.height;
+  if (!loadGame(SAVE_FILE, endRecordingForLoad)) {
+    fprintf(stderr, "Failed to load the game from %s\n", SAVE_FILE);
+    return;
+  }
+  if (!simWorldReplaced()) {
+    fprintf(stderr, "Failed to allocate the world frames\n");
+    exit(1);
+  }
+  if (_state.width != oldWidth || _state.height != oldHeight) {
+    resizeDisplay();
+  }
+  // The loaded game is a new map and can't be undone
+  streamReset();
+  if (!journalInit(HISTORY_BUDGET)) {
+    fprintf(stderr, "Not enough memory for the undo history\n");
+  }
+  *currentMenu = GAME_SCREEN;
+}
+
 void quitGameButtonAction(menu *_) { exit(0); }
 
-#define BUTTON_COUNT 4
+#define BUTTON_COUNT 6
 
 void handleNonGameScreen(menu *currentMenu) {
   BeginDrawing();
@@ -170,7 +204,7 @@ void handleNonGameScreen(menu *currentMenu) {
 
     const char *title = "Sand Game";
 
-    DrawTextCentered(font_bold, title, (Vector2){SCREEN_WIDTH / 2.0, 85},
+    DrawTextCentered(font_bold, title, (Vector2){layout.screenWidth / 2.0, 85},
                      TITLE_FONT_SIZE,
 
                      0.0f, RAYWHITE);
@@ -179,16 +213,19 @@ void handleNonGameScreen(menu *currentMenu) {
     const int BUTTON_WIDTH = 300.0f;
     const int BUTTON_HEIGHT = 50.0f;
     const int BUTTON_PADDING = 35.0f;
-    const int MIDDLE_OFFSET = 150.0f;
-    int x = SCREEN_WIDTH / 2;
-    int y = SCREEN_HEIGHT / 2.0 + MIDDLE_OFFSET -
-            (BUTTON_HEIGHT - BUTTON_PADDING) * 3;
-
-    const char *buttonText[BUTTON_COUNT] = {"New Game", "Resume Game",
-                                            "Settings", "Quit Game"};
+    const int TITLE_AREA_HEIGHT = 150.0f;
+    // Centre the buttons in the space under the title
+    int x = layout.screenWidth / 2;
+    int y = (layout.screenHeight + TITLE_AREA_HEIGHT) / 2 -
+            (BUTTON_COUNT - 1) * (BUTTON_HEIGHT + BUTTON_PADDING) / 2;
+
+    const char *buttonText[BUTTON_COUNT] = {"New Game",  "Resume Game",
+                                            "Save Game", "Load Game",
+                                            "Settings",  "Quit Game"};
     const buttonActionFunc buttonActions[BUTTON_COUNT] = {
-        newGameButtonAction, resumeGameButtonAction, openSettingsButtonAction,
-        quitGameButtonAction};
+        newGameButtonAction,  resumeGameButtonAction,
+        saveGameButtonAction, loadGameButtonAction,
+        openSettingsButtonAction, quitGameButtonAction};
 
     for (int i = 0; i < BUTTON_COUNT; i++) {
       // The currentMenu needs to be passed so the button action can be called
@@ -199,32 +236,171 @@ void handleNonGameScreen(menu *currentMenu) {
       y += BUTTON_PADDING + BUTTON_HEIGHT;
     }
   } else if (*currentMenu == SETTINGS_MENU) {
-    DrawTextCentered(font_bold, "Settings", (Vector2){SCREEN_WIDTH / 2.0, 50},
-                     70.0f, 0.0f, RAYWHITE);
-    DrawTextCentered(font, "Press [Esc] to go back!",
-                     (Vector2){SCREEN_WIDTH / 2.0, SCREEN_HEIGHT - 30.0f},
-                     20.0f, 0.0f, YELLOW);
+    DrawTextCentered(font_bold, "Settings",
+                     (Vector2){layout.screenWidth / 2.0, 50}, 70.0f, 0.0f,
+                     RAYWHITE);
+    DrawTextCentered(
+        font, "Press [Esc] to go back!",
+        (Vector2){layout.screenWidth / 2.0, layout.screenHeight - 30.0f},
+        20.0f, 0.0f, YELLOW);
   }
 
   EndDrawing();
 }
 
 void cleanup() {
+  unloadRenderer();
+
   // Unload the fonts
   UnloadFont(font);
   UnloadFont(font_bold);
 }
 
-int main() {
+// Settings chosen on the command line
+typedef struct {
+  int worldWidth;
+  int worldHeight;
+  // Passed to setTickThreads, 0 runs the tick on the simulation thread only
+  int tickThreads;
+  // File to record the session to, or NULL
+  const char *recordPath;
+  // Saved game to start with, or NULL
+  const char *loadPath;
+  // File to write the tick counters to, or NULL. Needs a PROFILE build
+  const char *profilePath;
+  // Directory to keep the chunks scrolled out of the world in, or NULL for a
+  // temporary one
+  const char *storePath;
+  // Memory the chunk store may use before writing chunks to disk, in MiB
+  int storeBudget;
+} options;
+
+// Parse the command line. Returns false on invalid arguments
+static bool parseArgs(int argc, char **argv, options *opts) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%dx%d", &opts->worldWidth, &opts->worldHeight) !=
+          2) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d", &opts->tickThreads) != 1) {
+        return false;
+      }
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      opts->recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+      opts->loadPath = argv[++i];
+    } else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc) {
+      opts->profilePath = argv[++i];
+    } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+      opts->storePath = argv[++i];
+    } else if (strcmp(argv[i], "--store-budget") == 0 && i + 1 < argc) {
+      if (sscanf(argv[++i], "%d", &opts->storeBudget) != 1 ||
+          opts->storeBudget < 0) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
 
   bool paused = false;
+  bool showProfile = false;
+
+  options opts = {.worldWidth = DEFAULT_WORLD_WIDTH,
+                  .worldHeight = DEFAULT_WORLD_HEIGHT,
+                  .tickThreads = 0,
+                  .recordPath = NULL,
+                  .loadPath = NULL,
+                  .profilePath = NULL,
+                  .storePath = NULL,
+                  .storeBudget = STREAM_BUDGET >> 20};
+  if (!parseArgs(argc, argv, &opts)) {
+    fprintf(stderr,
+            "usage: %s [--size WIDTHxHEIGHT] [--threads N] [--record FILE] "
+            "[--load FILE] [--profile-csv FILE] [--store DIR] "
+            "[--store-budget MIB]\n",
+            argv[0]);
+    return 1;
+  }
+  // A recording has to start from an empty world to be replayed
+  if (opts.recordPath != NULL && opts.loadPath != NULL) {
+    fprintf(stderr, "--record and --load can't be used together\n");
+    return 1;
+  }
+
+  if (opts.profilePath != NULL) {
+#ifdef PROFILE
+    if (!profileOpenCsv(opts.profilePath)) {
+      fprintf(stderr, "Failed to create %s\n", opts.profilePath);
+      return 1;
+    }
+#else
+    fprintf(stderr, "--profile-csv needs a build with PROFILE=1\n");
+    return 1;
+#endif
+  }
+
+  if (!initWorld(opts.worldWidth, opts.worldHeight)) {
+    fprintf(stderr, "World size must be between %dx%d and %dx%d\n",
+            MIN_WORLD_SIZE, MIN_WORLD_SIZE, MAX_WORLD_SIZE, MAX_WORLD_SIZE);
+    return 1;
+  }
+
+  if (!setTickThreads(opts.tickThreads)) {
+    fprintf(stderr, "Failed to start %d tick threads\n", opts.tickThreads);
+    return 1;
+  }
+
+  uint64_t seed = (uint64_t)time(NULL);
+  pcg32_init(seed);
+
+  if (opts.recordPath != NULL) {
+    recording_header header = {.width = opts.worldWidth,
+                               .height = opts.worldHeight,
+                               .tickThreads = opts.tickThreads,
+                               .seed = seed};
+    if (!startRecording(opts.recordPath, &header)) {
+      fprintf(stderr, "Failed to create the recording %s\n", opts.recordPath);
+      return 1;
+    }
+    // The quit button exits straight away, this makes sure the recording is
+    // still finished
+    atexit(stopRecording);
+  }
+
+  if (!streamInit(opts.storePath, (size_t)opts.storeBudget << 20)) {
+    fprintf(stderr, "Failed to create the chunk store\n");
+    return 1;
+  }
+  // Like the recording, the quit button would leave the stored chunks behind
+  atexit(streamShutdown);
 
-  pcg32_init((uint64_t)time(NULL));
+  InitBlockPalettes();
 
   // Init game state
   initGameState();
 
-  InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Sand Game");
+  // The saved world size replaces the one from --size
+  if (opts.loadPath != NULL && !loadGame(opts.loadPath, NULL)) {
+    fprintf(stderr, "Failed to load the game from %s\n", opts.loadPath);
+    return 1;
+  }
+  // The store was made for the world of --size
+  streamReset();
+
+  if (!journalInit(HISTORY_BUDGET)) {
+    fprintf(stderr, "Not enough memory for the undo history\n");
+  }
+
+  initLayout(_state.width, _state.height);
+
+  InitWindow(layout.screenWidth, layout.screenHeight, "Sand Game");
 
   // The exit key by default is [Escape] which we use for going back to the main
   // menu
@@ -237,15 +413,31 @@ int main() {
     return 1;
   }
 
+  if (!initRenderer()) {
+    fprintf(stderr, "Failed to create the world texture\n");
+    cleanup();
+    CloseWindow();
+    return 1;
+  }
+
+  if (!simStart()) {
+    fprintf(stderr, "Failed to start the simulation thread\n");
+    cleanup();
+    CloseWindow();
+    return 1;
+  }
+
   SetTextLineSpacing(16);
 
   SetTargetFPS(RENDER_FPS);
 
-  float timeSincePhysicsFrame = 0;
-
   menu currentMenu = MAIN_MENU;
 
   bool canPlace = true;
+  // Cell the brush was last painted at while the button is held, so the next
+  // stroke starts from it. Negative when no stroke is in progress
+  int strokeX = -1;
+  int strokeY = -1;
 
   // Main loop
   while (!WindowShouldClose()) {
@@ -255,6 +447,8 @@ int main() {
       currentMenu = MAIN_MENU;
     }
     if (currentMenu != GAME_SCREEN) {
+      // The menu actions change the world directly
+      simSetActive(false);
       // Need to make sure that when the menu changes, if the mouse is pressed
       // down it will not place any blocks until the user represses the mouse
       if (IsMouseButtonDown(MOUSE_BUTTON_LEFT)) {
@@ -264,6 +458,8 @@ int main() {
       continue;
     }
 
+    simSetActive(true);
+
     if (!canPlace && IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
       canPlace = true;
     }
@@ -272,71 +468,120 @@ int main() {
 
     ProcessKeys(state);
 
-    float delta = GetFrameTime();
-    timeSincePhysicsFrame += delta;
-
     int mouseX = GetMouseX();
     int mouseY = GetMouseY();
 
+    // The simulation thread ticks the world on its own
     if (IsKeyPressed(KEY_P)) {
       paused = !paused;
+      simPush(&(sim_command){.type = SIM_PAUSE, .value = paused});
+    }
+    if (paused && IsKeyPressed(KEY_PERIOD)) {
+      simPush(&(sim_command){.type = SIM_STEP});
+    }
+    if (IsKeyPressed(UNDO_KEY)) {
+      simPush(&(sim_command){.type = SIM_UNDO});
+    } else if (IsKeyPressed(REDO_KEY)) {
+      simPush(&(sim_command){.type = SIM_REDO});
+    }
+    int scrollX = IsKeyPressed(SCROLL_RIGHT) - IsKeyPressed(SCROLL_LEFT);
+    int scrollY = IsKeyPressed(SCROLL_UP) - IsKeyPressed(SCROLL_DOWN);
+    if (scrollX != 0 || scrollY != 0) {
+      // The world is moved while the simulation is idle
+      simSetActive(false);
+      recordScroll(scrollX, scrollY);
+      if (streamScroll(scrollX, scrollY) && !simWorldReplaced()) {
+        fprintf(stderr, "Failed to allocate the world frames\n");
+        exit(1);
+      }
+      simSetActive(true);
+      strokeX = strokeY = -1;
+    }
+    if (IsKeyPressed(PROFILE_OVERLAY_KEY)) {
+      showProfile = !showProfile;
     }
 
-    // The 0.98 is to give it a buffer, hopefully keeping the actual physics
-    // fps closer to the target
-    if (timeSincePhysicsFrame >= (1.0 / PHYSICS_FPS) * 0.98 && (!paused || (paused && IsKeyPressed(KEY_PERIOD)))) {
-      timeSincePhysicsFrame = 0.0;
-
-      // Update the world
-      worldTick();
+    float wheel = GetMouseWheelMove();
+    if (wheel != 0) {
+      zoomCamera(powf(ZOOM_STEP, wheel), mouseX, mouseY);
+    }
+    if (IsMouseButtonDown(PAN_BUTTON)) {
+      Vector2 delta = GetMouseDelta();
+      panCamera(delta.x, delta.y);
+    }
+    if (IsKeyPressed(RESET_VIEW_KEY)) {
+      resetCamera();
     }
 
     BeginDrawing();
     ClearBackground(BLACK);
 
-    if (mouseX >= WORLD_SCREEN_TOP_LEFT_X &&
-        mouseY >= WORLD_SCREEN_TOP_LEFT_Y &&
-        mouseX < WORLD_SCREEN_BOTTOM_RIGHT_X &&
-        mouseY < WORLD_SCREEN_BOTTOM_RIGHT_Y) {
-      if (IsMouseButtonDown(MOUSE_LEFT_BUTTON) && canPlace) {
-        int gridX = (mouseX - WORLD_SCREEN_TOP_LEFT_X) / PX_SCALE;
-        // Correct grid position because the y coordinates of blocks are
-        // flipped before rendering
-        int gridY =
-            WORLD_HEIGHT - (mouseY - WORLD_SCREEN_TOP_LEFT_Y) / PX_SCALE - 1;
-        int half = state->placeWidth / 2;
-
-        for (int x = max(gridX + -half, 0);
-             x <= min(gridX + half, WORLD_WIDTH - 1); x++) {
-          for (int y = max(-half + gridY, 0);
-               y <= min(half + gridY, WORLD_HEIGHT - 1); y++) {
-
-            Block *targetBlock = getBlock(x, y);
-            // Make sure the color does not change randomly
-            // We do not need bounds checking because that is already handled in
-            // GetBlock
-            if (targetBlock != NULL &&
-                targetBlock->type != state->selectedBlockType) {
-              setBlock(x, y,
-                       (Block){.type = state->selectedBlockType,
-                               .color = GenBlockColor(state->selectedBlockType),
-                               .movementDir = DIR_NONE});
-            }
-          }
+    int gridX, gridY;
+    bool inWorld = screenToCell(mouseX, mouseY, &gridX, &gridY);
+    if (inWorld && IsMouseButtonDown(MOUSE_LEFT_BUTTON) && canPlace) {
+      if (state->tool != TOOL_BRUSH) {
+        if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+          simPush(&(sim_command){.type = SIM_CHECKPOINT});
+          pushRegionEdit(state, gridX, gridY);
+        }
+      } else {
+        // A whole stroke is undone at once. The stroke only starts once its
+        // checkpoint is queued, so a dropped one is tried again next frame
+        if (strokeX < 0 && simPush(&(sim_command){.type = SIM_CHECKPOINT})) {
+          strokeX = gridX;
+          strokeY = gridY;
+        }
+        // Paint along the line from the last cell so fast strokes leave no
+        // gaps. If the simulation has fallen far behind the line is dropped
+        // and the next one starts from the same cell again
+        if (strokeX >= 0 &&
+            simPush(&(sim_command){
+                .type = SIM_EDIT,
+                .edit = {.type = EDIT_LINE,
+                         .x0 = strokeX,
+                         .y0 = strokeY,
+                         .x1 = gridX,
+                         .y1 = gridY,
+                         .width = state->placeWidth,
+                         .blockType = state->selectedBlockType}})) {
+          strokeX = gridX;
+          strokeY = gridY;
         }
       }
+    } else {
+      // The stroke ends when the button is released or the cursor leaves the
+      // world
+      strokeX = strokeY = -1;
     }
 
+    PROFILE_BEGIN(TIMER_DRAW_WORLD);
     drawWorld(state, mouseX, mouseY);
+    PROFILE_END(TIMER_DRAW_WORLD);
 
     // Draw the interface at the bottom of the screen
+    PROFILE_BEGIN(TIMER_DRAW_INTERFACE);
     drawInterface(state);
+    PROFILE_END(TIMER_DRAW_INTERFACE);
+
+#ifdef PROFILE
+    if (showProfile) {
+      drawProfileOverlay();
+    }
+#endif
 
     EndDrawing();
   }
 
+  simStop();
+
+#ifdef PROFILE
+  profileCloseCsv();
+#endif
+
   cleanup();
 
+  setTickThreads(0);
+
   CloseWindow(); // Close window and clean up
 
   return 0;
@@ -0,0 +1,176 @@
+#include "planes.h"
+#include "census.h"
+#include "state.h"
+#include "utils.h"
+#include <string.h>
+
+#define UINT64_BITS (sizeof(uint64_t) * 8)
+
+static uint64_t *planes[PLANE_COUNT];
+// Words per row. Rows are padded to whole words so a word never holds cells
+// from two rows
+static int planeStride;
+static int planeRows;
+
+// Which planes each block type sets, as a bitmask of plane indices
+static uint8_t typePlanes[BLOCK_TYPES_COUNT];
+
+static uint8_t planesForType(int type) {
+  uint64_t props = BLOCKS[type].props;
+  uint8_t mask = 0;
+  if (HAS_PROPERTY(props, HAS_GRAVITY) || HAS_PROPERTY(props, CAN_SLIDE)) {
+    mask |= 1 << PLANE_FALLS;
+  }
+  if (HAS_PROPERTY(props, IS_PASSIBLE) || HAS_PROPERTY(props, IS_FLUID)) {
+    mask |= 1 << PLANE_OPEN;
+  }
+  if (HAS_PROPERTY(props, IS_PASSIBLE)) {
+    mask |= 1 << PLANE_PASSIBLE;
+  }
+  if (HAS_PROPERTY(props, IS_FLUID)) {
+    mask |= 1 << PLANE_FLUID;
+  }
+  if (HAS_PROPERTY(props, IS_GAS)) {
+    mask |= 1 << PLANE_GAS;
+  }
+  return mask;
+}
+
+size_t initPlanes(arena *a, int width, int height) {
+  int stride = (width + UINT64_BITS - 1) / UINT64_BITS;
+  size_t planeBytes = (size_t)stride * height * sizeof(uint64_t);
+  if (a == NULL) {
+    return (planeBytes + ARENA_ALIGN) * PLANE_COUNT;
+  }
+  planeStride = stride;
+  planeRows = height;
+
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    typePlanes[type] = planesForType(type);
+  }
+  for (int p = 0; p < PLANE_COUNT; p++) {
+    planes[p] = arenaAlloc(a, planeBytes, ARENA_ALIGN);
+  }
+  return planeBytes * PLANE_COUNT;
+}
+
+// The cells written a span at a time have to be counted again for the census
+// as well, see census.h
+void rebuildPlanes(void) {
+  censusMarkAll();
+  for (int p = 0; p < PLANE_COUNT; p++) {
+    memset(planes[p], 0, (size_t)planeStride * planeRows * sizeof(uint64_t));
+  }
+  for (int y = 0; y < _state.height; y++) {
+    const Block *row = &_state.world[(size_t)y * _state.width];
+    for (int x = 0; x < _state.width; x++) {
+      uint8_t set = typePlanes[row[x].type];
+      size_t word = (size_t)y * planeStride + x / UINT64_BITS;
+      uint64_t bit = 1ULL << (x % UINT64_BITS);
+      for (int p = 0; p < PLANE_COUNT; p++) {
+        if ((set >> p) & 1) {
+          planes[p][word] |= bit;
+        }
+      }
+    }
+  }
+}
+
+// Mask of bits from to to inclusive of a word
+static inline uint64_t spanMask(int from, int to) {
+  return (~0ULL >> (UINT64_BITS - 1 - to)) & (~0ULL << from);
+}
+
+void setPlaneSpan(int y, int minX, int maxX, uint8_t type) {
+  censusMarkSpan(y, minX, maxX);
+  uint8_t set = typePlanes[type];
+  for (int w = minX / UINT64_BITS; w <= maxX / (int)UINT64_BITS; w++) {
+    int base = w * UINT64_BITS;
+    uint64_t span = spanMask(max(minX, base) - base,
+                             min(maxX, base + (int)UINT64_BITS - 1) - base);
+    for (int p = 0; p < PLANE_COUNT; p++) {
+      uint64_t *word = &planes[p][(size_t)y * planeStride + w];
+      *word = (set >> p) & 1 ? *word | span : *word & ~span;
+    }
+  }
+}
+
+void rebuildPlaneSpan(int y, int minX, int maxX) {
+  censusMarkSpan(y, minX, maxX);
+  const Block *row = &_state.world[(size_t)y * _state.width];
+  for (int w = minX / UINT64_BITS; w <= maxX / (int)UINT64_BITS; w++) {
+    int base = w * UINT64_BITS;
+    int from = max(minX, base) - base;
+    int to = min(maxX, base + (int)UINT64_BITS - 1) - base;
+    uint64_t span = spanMask(from, to);
+
+    uint64_t bits[PLANE_COUNT] = {0};
+    for (int i = from; i <= to; i++) {
+      uint8_t set = typePlanes[row[base + i].type];
+      for (int p = 0; p < PLANE_COUNT; p++) {
+        bits[p] |= (uint64_t)((set >> p) & 1) << i;
+      }
+    }
+    for (int p = 0; p < PLANE_COUNT; p++) {
+      uint64_t *word = &planes[p][(size_t)y * planeStride + w];
+      *word = (*word & ~span) | bits[p];
+    }
+  }
+}
+
+void setPlaneCell(int x, int y, uint8_t oldType, uint8_t newType,
+                  bool atomic) {
+  uint8_t changed = typePlanes[oldType] ^ typePlanes[newType];
+  if (changed == 0) {
+    return;
+  }
+
+  uint8_t set = typePlanes[newType];
+  size_t word = (size_t)y * planeStride + x / UINT64_BITS;
+  uint64_t bit = 1ULL << (x % UINT64_BITS);
+  for (int p = 0; p < PLANE_COUNT; p++) {
+    if (((changed >> p) & 1) == 0) {
+      continue;
+    }
+    uint64_t *target = &planes[p][word];
+    bool on = (set >> p) & 1;
+    // Cells of neighbouring chunks share words, so a parallel tick needs
+    // atomic read-modify-writes
+    if (atomic) {
+      if (on) {
+        __atomic_fetch_or(target, bit, __ATOMIC_RELAXED);
+      } else {
+        __atomic_fetch_and(target, ~bit, __ATOMIC_RELAXED);
+      }
+    } else {
+      *target = on ? *target | bit : *target & ~bit;
+    }
+  }
+}
+
+// Load a plane word, or 0 for words outside of the world
+static inline uint64_t planeWord(plane p, int y, int w, bool atomic) {
+  if (y < 0 || y >= planeRows || w < 0 || w >= planeStride) {
+    return 0;
+  }
+  uint64_t *word = &planes[p][(size_t)y * planeStride + w];
+  return atomic ? __atomic_load_n(word, __ATOMIC_RELAXED) : *word;
+}
+
+uint64_t fallCandidates(int y, int w, bool atomic) {
+  uint64_t open = planeWord(PLANE_OPEN, y - 1, w, atomic);
+  // Shift in the edge bits of the neighbouring words so the diagonals across
+  // word boundaries are seen
+  uint64_t openLeft =
+      open << 1 | planeWord(PLANE_OPEN, y - 1, w - 1, atomic) >> 63;
+  uint64_t openRight =
+      open >> 1 | planeWord(PLANE_OPEN, y - 1, w + 1, atomic) << 63;
+  return (planeWord(PLANE_FALLS, y, w, atomic) &
+          (open | openLeft | openRight)) |
+         planeWord(PLANE_FLUID, y, w, atomic);
+}
+
+uint64_t gasCandidates(int y, int w, bool atomic) {
+  return planeWord(PLANE_GAS, y, w, atomic) &
+         planeWord(PLANE_PASSIBLE, y + 1, w, atomic);
+}
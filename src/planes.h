@@ -0,0 +1,48 @@
+#pragma once
+
+#include "arena.h"
+#include "block.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Packed bitmasks of cell properties, one bit per cell, kept up to date on
+// every write. The tick tests 64 cells of a row at once against them and only
+// runs the per-cell rules on cells that might move.
+
+typedef enum {
+  // Cells that fall or slide
+  PLANE_FALLS,
+  // Cells a falling cell can move into: passible cells and fluids
+  PLANE_OPEN,
+  PLANE_PASSIBLE,
+  PLANE_FLUID,
+  PLANE_GAS,
+  PLANE_COUNT
+} plane;
+
+// Allocate the planes for a world of the given size from the arena and clear
+// them. Returns the number of bytes needed when a is NULL
+size_t initPlanes(arena *a, int width, int height);
+
+// Recompute every plane from the world cells
+void rebuildPlanes(void);
+
+// Recompute the planes for cells minX to maxX of row y from the world cells,
+// a word at a time. For writes of whole row spans
+void rebuildPlaneSpan(int y, int minX, int maxX);
+
+// Update the planes for cells minX to maxX of row y after they were all set
+// to the type. Only touches whole words, without reading the cells
+void setPlaneSpan(int y, int minX, int maxX, uint8_t type);
+
+// Update the planes for a cell whose type changed. atomic must be set when
+// other threads may write to the planes at the same time
+void setPlaneCell(int x, int y, uint8_t oldType, uint8_t newType, bool atomic);
+
+// Cells in the 64 cell word w of row y that might move in the fall pass:
+// falling cells with an open cell below or diagonally below, and every fluid.
+// Any cell not in the mask would do nothing if it was updated
+uint64_t fallCandidates(int y, int w, bool atomic);
+
+// Gas cells in the 64 cell word w of row y with a passible cell above them
+uint64_t gasCandidates(int y, int w, bool atomic);
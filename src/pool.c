@@ -0,0 +1,136 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+enum { MAX_POOL_THREADS = 64 };
+
+static struct {
+  bool running;
+  pthread_t workers[MAX_POOL_THREADS];
+  // Number of worker threads, not counting the thread that calls poolRun
+  int workerCount;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+
+  // Bumped for every batch so workers can tell a new batch from a spurious
+  // wake up
+  unsigned long generation;
+  // Workers that have not finished the current batch yet
+  int busy;
+  bool stopping;
+
+  pool_job_func func;
+  void *arg;
+  int jobs;
+  // Index of the next job to hand out, shared by every thread
+  int nextJob;
+} pool;
+
+static void runJobs(void) {
+  for (;;) {
+    int job = __atomic_fetch_add(&pool.nextJob, 1, __ATOMIC_RELAXED);
+    if (job >= pool.jobs) {
+      return;
+    }
+    pool.func(pool.arg, job);
+  }
+}
+
+static void *workerMain(void *_) {
+  (void)_;
+  unsigned long seen = 0;
+  pthread_mutex_lock(&pool.lock);
+  for (;;) {
+    while (pool.generation == seen && !pool.stopping) {
+      pthread_cond_wait(&pool.start, &pool.lock);
+    }
+    if (pool.stopping) {
+      break;
+    }
+    seen = pool.generation;
+    pthread_mutex_unlock(&pool.lock);
+
+    runJobs();
+
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.busy == 0) {
+      pthread_cond_signal(&pool.done);
+    }
+  }
+  pthread_mutex_unlock(&pool.lock);
+  return NULL;
+}
+
+bool poolInit(int threads) {
+  poolShutdown();
+  if (threads < 1 || threads > MAX_POOL_THREADS) {
+    return false;
+  }
+
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.start, NULL);
+  pthread_cond_init(&pool.done, NULL);
+  pool.stopping = false;
+  pool.generation = 0;
+  pool.running = true;
+
+  for (int i = 0; i < threads - 1; i++) {
+    if (pthread_create(&pool.workers[i], NULL, workerMain, NULL) != 0) {
+      poolShutdown();
+      return false;
+    }
+    pool.workerCount++;
+  }
+  return true;
+}
+
+void poolRun(pool_job_func func, void *arg, int jobs) {
+  if (pool.workerCount == 0 || jobs <= 1) {
+    for (int job = 0; job < jobs; job++) {
+      func(arg, job);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.func = func;
+  pool.arg = arg;
+  pool.jobs = jobs;
+  pool.nextJob = 0;
+  pool.busy = pool.workerCount;
+  pool.generation++;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  runJobs();
+
+  pthread_mutex_lock(&pool.lock);
+  while (pool.busy > 0) {
+    pthread_cond_wait(&pool.done, &pool.lock);
+  }
+  pthread_mutex_unlock(&pool.lock);
+}
+
+void poolShutdown(void) {
+  if (!pool.running) {
+    return;
+  }
+  pthread_mutex_lock(&pool.lock);
+  pool.stopping = true;
+  pthread_cond_broadcast(&pool.start);
+  pthread_mutex_unlock(&pool.lock);
+
+  for (int i = 0; i < pool.workerCount; i++) {
+    pthread_join(pool.workers[i], NULL);
+  }
+  pool.workerCount = 0;
+
+  pthread_mutex_destroy(&pool.lock);
+  pthread_cond_destroy(&pool.start);
+  pthread_cond_destroy(&pool.done);
+  pool.running = false;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+// A fixed set of worker threads that run batches of independent jobs
+
+typedef void (*pool_job_func)(void *arg, int job);
+
+// Start the pool with the given number of threads, counting the calling
+// thread. Calling it again restarts the pool with the new count
+bool poolInit(int threads);
+
+// Run func(arg, job) for every job in [0, jobs) and wait for all of them to
+// finish. The calling thread works on jobs as well
+void poolRun(pool_job_func func, void *arg, int jobs);
+
+void poolShutdown(void);
@@ -0,0 +1,87 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include <stdio.h>
+#include <time.h>
+
+const char *const PROFILE_STAT_NAMES[STAT_COUNT] = {
+    [STAT_VISITED] = "visited",       [STAT_SKIPPED] = "skipped",
+    [STAT_FALLS] = "falls",           [STAT_SLIDES] = "slides",
+    [STAT_FLUID_MOVES] = "fluid_moves", [STAT_GAS_RISES] = "gas_rises",
+    [STAT_LAST_RESORT] = "last_resort",
+};
+
+const char *const PROFILE_TIMER_NAMES[TIMER_COUNT] = {
+    [TIMER_TICK] = "tick",
+    [TIMER_DRAW_WORLD] = "draw_world",
+    [TIMER_DRAW_INTERFACE] = "draw_interface",
+};
+
+// Written by whichever thread owns the value and read by any, so every access
+// is atomic
+static profile_sample latest;
+
+static FILE *csv;
+
+uint64_t profileNowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profileRecordTimer(profile_timer timer, uint64_t ns) {
+  __atomic_store_n(&latest.timerNs[timer], ns, __ATOMIC_RELAXED);
+}
+
+void profileEndTick(uint64_t tick, const uint64_t *stats) {
+  __atomic_store_n(&latest.tick, tick, __ATOMIC_RELAXED);
+  for (int i = 0; i < STAT_COUNT; i++) {
+    __atomic_store_n(&latest.stats[i], stats[i], __ATOMIC_RELAXED);
+  }
+
+  if (csv != NULL) {
+    fprintf(csv, "%llu", (unsigned long long)tick);
+    for (int i = 0; i < STAT_COUNT; i++) {
+      fprintf(csv, ",%llu", (unsigned long long)stats[i]);
+    }
+    fprintf(csv, ",%llu\n",
+            (unsigned long long)__atomic_load_n(&latest.timerNs[TIMER_TICK],
+                                                __ATOMIC_RELAXED));
+  }
+}
+
+void profileRead(profile_sample *out) {
+  out->tick = __atomic_load_n(&latest.tick, __ATOMIC_RELAXED);
+  for (int i = 0; i < STAT_COUNT; i++) {
+    out->stats[i] = __atomic_load_n(&latest.stats[i], __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    out->timerNs[i] = __atomic_load_n(&latest.timerNs[i], __ATOMIC_RELAXED);
+  }
+}
+
+bool profileOpenCsv(const char *path) {
+  profileCloseCsv();
+  csv = fopen(path, "w");
+  if (csv == NULL) {
+    return false;
+  }
+  fprintf(csv, "tick");
+  for (int i = 0; i < STAT_COUNT; i++) {
+    fprintf(csv, ",%s", PROFILE_STAT_NAMES[i]);
+  }
+  fprintf(csv, ",tick_ns\n");
+  return true;
+}
+
+void profileCloseCsv(void) {
+  if (csv != NULL) {
+    fclose(csv);
+    csv = NULL;
+  }
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters and timers for the hot paths, only compiled in when PROFILE is
+// defined (make PROFILE=1). Without it every macro expands to nothing and the
+// functions are not built, so release builds pay nothing for them.
+
+typedef enum {
+  // Cells the tick ran the update rules on
+  STAT_VISITED,
+  // Cells skipped because they already moved this tick
+  STAT_SKIPPED,
+  STAT_FALLS,
+  STAT_SLIDES,
+  STAT_FLUID_MOVES,
+  STAT_GAS_RISES,
+  // Cells that swapped with the fluid below them because nothing else was free
+  STAT_LAST_RESORT,
+  STAT_COUNT
+} profile_stat;
+
+typedef enum {
+  TIMER_TICK,
+  TIMER_DRAW_WORLD,
+  TIMER_DRAW_INTERFACE,
+  TIMER_COUNT
+} profile_timer;
+
+#ifdef PROFILE
+
+// Values for the last tick and the last run of every timer
+typedef struct {
+  uint64_t tick;
+  uint64_t stats[STAT_COUNT];
+  uint64_t timerNs[TIMER_COUNT];
+} profile_sample;
+
+extern const char *const PROFILE_STAT_NAMES[STAT_COUNT];
+extern const char *const PROFILE_TIMER_NAMES[TIMER_COUNT];
+
+uint64_t profileNowNs(void);
+
+void profileRecordTimer(profile_timer timer, uint64_t ns);
+
+// Publish the counts of a finished tick, adding a row to the CSV file if one
+// is open. Called from the thread that runs the tick
+void profileEndTick(uint64_t tick, const uint64_t *stats);
+
+// Copy the latest values. Safe to call from any thread
+void profileRead(profile_sample *out);
+
+// Write a row per tick to the file from now on. Returns false if it can't be
+// created
+bool profileOpenCsv(const char *path);
+
+void profileCloseCsv(void);
+
+#define PROFILE_COUNT(stats, stat) ((stats)[stat]++)
+#define PROFILE_BEGIN(timer) uint64_t profileStart_##timer = profileNowNs()
+#define PROFILE_END(timer)                                                     \
+  profileRecordTimer(timer, profileNowNs() - profileStart_##timer)
+
+#else
+
+#define PROFILE_COUNT(stats, stat) ((void)0)
+#define PROFILE_BEGIN(timer) ((void)0)
+#define PROFILE_END(timer) ((void)0)
+
+#endif
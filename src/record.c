@@ -0,0 +1,223 @@
+#include "record.h"
+#include "bytes.h"
+#include "journal.h"
+#include "state.h"
+#include "stream.h"
+#include <string.h>
+
+#define RECORDING_MAGIC "SNDR"
+
+// Version 2 replaced the brush events with edits. Version 3 added the undo
+// events and version 4 the scroll event
+enum { RECORDING_VERSION = 4 };
+
+static FILE *recording;
+
+// The readers return false at the end of the file
+static bool getU8(FILE *file, uint8_t *value) {
+  int c = fgetc(file);
+  if (c == EOF) {
+    return false;
+  }
+  *value = c;
+  return true;
+}
+
+static bool getU16(FILE *file, uint16_t *value) {
+  uint8_t lo, hi;
+  if (!getU8(file, &lo) || !getU8(file, &hi)) {
+    return false;
+  }
+  *value = lo | hi << 8;
+  return true;
+}
+
+static bool getU32(FILE *file, uint32_t *value) {
+  uint16_t lo, hi;
+  if (!getU16(file, &lo) || !getU16(file, &hi)) {
+    return false;
+  }
+  *value = lo | (uint32_t)hi << 16;
+  return true;
+}
+
+static bool getU64(FILE *file, uint64_t *value) {
+  uint32_t lo, hi;
+  if (!getU32(file, &lo) || !getU32(file, &hi)) {
+    return false;
+  }
+  *value = lo | (uint64_t)hi << 32;
+  return true;
+}
+
+bool startRecording(const char *path, const recording_header *header) {
+  stopRecording();
+  recording = fopen(path, "wb");
+  if (recording == NULL) {
+    return false;
+  }
+  fputs(RECORDING_MAGIC, recording);
+  putU8(recording, RECORDING_VERSION);
+  putU16(recording, header->width);
+  putU16(recording, header->height);
+  // Every thread count above 0 gives the same result, so the count only has to
+  // fit in a byte
+  putU8(recording, header->tickThreads > 255 ? 255 : header->tickThreads);
+  putU64(recording, header->seed);
+  return true;
+}
+
+void recordEvent(event_type type, int value) {
+  if (recording == NULL) {
+    return;
+  }
+  putU8(recording, type);
+  putU32(recording, _state.tick);
+  if (type == EVENT_PAUSE) {
+    putU8(recording, value);
+  }
+}
+
+void recordEdit(const world_edit *edit) {
+  if (recording == NULL) {
+    return;
+  }
+  putU8(recording, EVENT_EDIT);
+  putU32(recording, _state.tick);
+  putU8(recording, edit->type);
+  putU32(recording, (uint32_t)edit->x0);
+  putU32(recording, (uint32_t)edit->y0);
+  putU32(recording, (uint32_t)edit->x1);
+  putU32(recording, (uint32_t)edit->y1);
+  putU16(recording, edit->width);
+  putU8(recording, edit->blockType);
+  putU8(recording, edit->fromType);
+}
+
+void recordScroll(int dx, int dy) {
+  if (recording == NULL) {
+    return;
+  }
+  putU8(recording, EVENT_SCROLL);
+  putU32(recording, _state.tick);
+  putU32(recording, (uint32_t)dx);
+  putU32(recording, (uint32_t)dy);
+}
+
+void stopRecording() {
+  if (recording == NULL) {
+    return;
+  }
+  recordEvent(EVENT_END, 0);
+  fclose(recording);
+  recording = NULL;
+}
+
+bool isRecording() { return recording != NULL; }
+
+FILE *openRecording(const char *path, recording_header *header) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return NULL;
+  }
+  char magic[sizeof(RECORDING_MAGIC) - 1];
+  uint8_t version, threads;
+  uint16_t width, height;
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+      memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 ||
+      !getU8(file, &version) || version != RECORDING_VERSION ||
+      !getU16(file, &width) || !getU16(file, &height) ||
+      !getU8(file, &threads) || !getU64(file, &header->seed)) {
+    fclose(file);
+    return NULL;
+  }
+  header->width = width;
+  header->height = height;
+  header->tickThreads = threads;
+  return file;
+}
+
+static bool getEdit(FILE *file, world_edit *edit) {
+  uint8_t type, blockType, fromType;
+  uint32_t coords[4];
+  uint16_t width;
+  if (!getU8(file, &type)) {
+    return false;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (!getU32(file, &coords[i])) {
+      return false;
+    }
+  }
+  if (!getU16(file, &width) || !getU8(file, &blockType) ||
+      !getU8(file, &fromType)) {
+    return false;
+  }
+  *edit = (world_edit){.type = type,
+                       .x0 = (int32_t)coords[0],
+                       .y0 = (int32_t)coords[1],
+                       .x1 = (int32_t)coords[2],
+                       .y1 = (int32_t)coords[3],
+                       .width = width,
+                       .blockType = blockType,
+                       .fromType = fromType};
+  return isValidEdit(edit);
+}
+
+bool readEvent(FILE *file, input_event *event) {
+  uint8_t type;
+  if (!getU8(file, &type) || type >= EVENT_TYPES_COUNT ||
+      !getU32(file, &event->tick)) {
+    return false;
+  }
+  event->type = type;
+  event->value = 0;
+
+  uint8_t u8;
+  uint32_t dx, dy;
+  switch (event->type) {
+  case EVENT_EDIT:
+    return getEdit(file, &event->edit);
+  case EVENT_PAUSE:
+    if (!getU8(file, &u8)) {
+      return false;
+    }
+    event->value = u8;
+    break;
+  case EVENT_SCROLL:
+    if (!getU32(file, &dx) || !getU32(file, &dy)) {
+      return false;
+    }
+    event->scrollX = (int32_t)dx;
+    event->scrollY = (int32_t)dy;
+    break;
+  default:
+    break;
+  }
+  return true;
+}
+
+void applyEvent(const input_event *event) {
+  switch (event->type) {
+  case EVENT_EDIT:
+    applyEdit(&event->edit);
+    break;
+  case EVENT_NEW_GAME:
+    initGameState();
+    break;
+  case EVENT_CHECKPOINT:
+    journalCheckpoint();
+    break;
+  case EVENT_UNDO:
+    journalUndo();
+    break;
+  case EVENT_REDO:
+    journalRedo();
+    break;
+  case EVENT_SCROLL:
+    streamScroll(event->scrollX, event->scrollY);
+    break;
+  default:
+    break;
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "edit.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Recording of everything that feeds into a game: the world size, tick mode and
+// seed, followed by the input events in the order they were applied. Each
+// event is stamped with the tick count at the time, so replaying a recording
+// by applying each event once the game reaches its tick reproduces the game
+// exactly.
+//
+// The file starts with a header of "SNDR", a version byte, the width and
+// height as u16, the tick thread count as a u8 and the seed as a u64. Each
+// event is a type byte, the tick as a u32 and then its fields. An edit is its
+// type as a u8, x0, y0, x1 and y1 as signed 32-bit values, the width as a u16
+// and the block type and the type it replaces as u8s. A scroll is the chunks
+// moved by in x and y as signed 32-bit values. All numbers are little endian.
+//
+// Undo keeps a history bounded by HISTORY_BUDGET, so a recording with undos
+// only replays exactly with the same budget.
+
+typedef enum {
+  // Apply the world edit in edit
+  EVENT_EDIT,
+  // Pause when value is 1, resume when it is 0. Ticks only happen while
+  // running, so this is only informative on replay
+  EVENT_PAUSE,
+  // Run a single tick while paused. Also only informative
+  EVENT_STEP,
+  // Start a new game
+  EVENT_NEW_GAME,
+  // Start a new undo step
+  EVENT_CHECKPOINT,
+  // Undo the last step
+  EVENT_UNDO,
+  // Redo the last undone step
+  EVENT_REDO,
+  // Move the world through the map by scrollX, scrollY chunks
+  EVENT_SCROLL,
+  // Last event of a complete recording, at the final tick
+  EVENT_END,
+  EVENT_TYPES_COUNT
+} event_type;
+
+typedef struct {
+  event_type type;
+  uint32_t tick;
+  int value;
+  world_edit edit;
+  int scrollX;
+  int scrollY;
+} input_event;
+
+typedef struct {
+  int width;
+  int height;
+  int tickThreads;
+  uint64_t seed;
+} recording_header;
+
+// Start writing a recording to the file, replacing it. Returns false if it
+// can't be created
+bool startRecording(const char *path, const recording_header *header);
+
+// Append an event stamped with the current tick. Does nothing when not
+// recording
+void recordEvent(event_type type, int value);
+
+// Append an edit event stamped with the current tick. Does nothing when not
+// recording
+void recordEdit(const world_edit *edit);
+
+// Append a scroll event stamped with the current tick. Does nothing when not
+// recording
+void recordScroll(int dx, int dy);
+
+// Write the end event and close the file
+void stopRecording();
+
+bool isRecording();
+
+// Open a recording and read its header. Returns NULL if the file can't be read
+// or is not a recording
+FILE *openRecording(const char *path, recording_header *header);
+
+// Read the next event. Returns false at the end of the file or if the event
+// is malformed
+bool readEvent(FILE *file, input_event *event);
+
+// Apply an event read from a recording to the game state
+void applyEvent(const input_event *event);
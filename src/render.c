@@ -0,0 +1,447 @@
+#include "render.h"
+#include "block.h"
+#include "chunk.h"
+#include "consts.h"
+#include "raylib.h"
+#include "sim.h"
+#include "state.h"
+#include "ui.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+  // Level 0 has a texel per cell and the last level a texel per chunk
+  LOD_LEVELS = 6,
+  // Most chunks rewritten from their cells in a frame, an eighth of the
+  // biggest world. When more changed the rest are left for the next frames,
+  // so a tick that changes most of a big world doesn't stall a single frame
+  CHUNK_WRITE_BUDGET = 2048,
+  // Grid tiles of GRID_MIN_ZOOM pixels and each size doubled up to MAX_ZOOM
+  GRID_TILES = 4,
+};
+
+typedef struct {
+  int width;
+  int height;
+  // Texels stored top row first like the texture, while texel rows count up
+  // from the bottom like the cells
+  Color *pixels;
+  Texture2D texture;
+  // Version of the frame each chunk's texels were last written from and the
+  // version they had when last uploaded, stored like the chunks. 0 when they
+  // never were
+  uint64_t *written;
+  uint64_t *uploaded;
+} lod_level;
+
+view_camera camera;
+
+static lod_level levels[LOD_LEVELS];
+// Chunks rewritten from their cells this frame
+static int chunksWritten;
+// Chunk row the rewriting starts from, after the last one reached by the frame
+// before, so rows left over when the budget runs out come first next time
+static int nextChunkRow;
+// A row of chunks of level 0 texels, to gather the texels of a few chunks into
+// one upload
+static Color *uploadBuffer;
+// Colour of every air cell. Chunks of nothing but air are filled with it at
+// any level without looking at their cells, unless air has more than one
+static Color airColor;
+static bool fillAir;
+// A cell with its grid lines along the left and top edges, at each tile size.
+// The grid is drawn as the biggest tile no wider than a cell on screen,
+// repeated over the view and scaled up to the cells, so its lines stay one or
+// two pixels wide at any zoom
+static Texture2D gridTiles[GRID_TILES];
+
+// Texels of the level covering the chunk. Every level is a whole number of
+// texels per chunk, the chunks at the right and top edges are clipped
+static cell_rect chunkTexels(const lod_level *lod, int level, int index) {
+  int size = CHUNK_SIZE >> level;
+  int minX = index % _state.chunksX * size;
+  int minY = index / _state.chunksX * size;
+  return (cell_rect){.minX = minX,
+                     .minY = minY,
+                     .maxX = min(minX + size, lod->width) - 1,
+                     .maxY = min(minY + size, lod->height) - 1};
+}
+
+static Color *texelRow(const lod_level *lod, int y) {
+  return &lod->pixels[(size_t)(lod->height - y - 1) * lod->width];
+}
+
+static bool loadGridTiles() {
+  for (int i = 0; i < GRID_TILES; i++) {
+    int size = GRID_MIN_ZOOM << i;
+    Image image = GenImageColor(size, size, BLANK);
+    if (image.data == NULL) {
+      return false;
+    }
+    Color *pixels = image.data;
+    for (int j = 0; j < size; j++) {
+      pixels[j] = GRID_LINE_COLOR;
+      pixels[j * size] = GRID_LINE_COLOR;
+    }
+    gridTiles[i] = LoadTextureFromImage(image);
+    UnloadImage(image);
+    if (gridTiles[i].id == 0) {
+      return false;
+    }
+    SetTextureWrap(gridTiles[i], TEXTURE_WRAP_REPEAT);
+  }
+  return true;
+}
+
+bool initRenderer() {
+  int chunks = _state.chunksX * _state.chunksY;
+  for (int level = 0; level < LOD_LEVELS; level++) {
+    lod_level *lod = &levels[level];
+    int scale = 1 << level;
+    lod->width = (_state.width + scale - 1) / scale;
+    lod->height = (_state.height + scale - 1) / scale;
+    lod->pixels = calloc((size_t)lod->width * lod->height, sizeof(Color));
+    lod->written = calloc(chunks, sizeof(uint64_t));
+    lod->uploaded = calloc(chunks, sizeof(uint64_t));
+    if (lod->pixels == NULL || lod->written == NULL ||
+        lod->uploaded == NULL) {
+      return false;
+    }
+
+    Image image = {.data = lod->pixels,
+                   .width = lod->width,
+                   .height = lod->height,
+                   .mipmaps = 1,
+                   .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+    lod->texture = LoadTextureFromImage(image);
+    if (lod->texture.id == 0) {
+      return false;
+    }
+    // Cells are drawn as sharp squares, the coarser levels are only drawn at
+    // one to two pixels per texel where blending them looks smoother
+    SetTextureFilter(lod->texture, level == 0 ? TEXTURE_FILTER_POINT
+                                              : TEXTURE_FILTER_BILINEAR);
+  }
+  uploadBuffer =
+      malloc((size_t)levels[0].width * CHUNK_SIZE * sizeof(Color));
+  if (uploadBuffer == NULL) {
+    return false;
+  }
+  if (!loadGridTiles()) {
+    return false;
+  }
+
+  airColor = BlockColor(&AIR_BLOCK);
+  fillAir = true;
+  for (int variant = 0; variant < PALETTE_SIZE; variant++) {
+    Color c = BlockColor(&(Block){.type = AIR, .variant = variant});
+    fillAir = fillAir && memcmp(&c, &airColor, sizeof(Color)) == 0;
+  }
+
+  resetCamera();
+  return true;
+}
+
+void invalidateRenderer() {
+  size_t chunks = (size_t)_state.chunksX * _state.chunksY;
+  for (int level = 0; level < LOD_LEVELS; level++) {
+    memset(levels[level].written, 0, chunks * sizeof(uint64_t));
+    memset(levels[level].uploaded, 0, chunks * sizeof(uint64_t));
+  }
+}
+
+static float viewWidth() {
+  return layout.worldBottomRightX - layout.worldTopLeftX;
+}
+
+static float viewHeight() {
+  return layout.worldBottomRightY - layout.worldTopLeftY;
+}
+
+// Keep the centre of the view where the view stays inside the world, or in
+// the middle of the world along a side where the whole world is in view
+static float clampAxis(float centre, float viewSize, int worldSize) {
+  float half = viewSize / (2 * camera.zoom);
+  if (half * 2 >= worldSize) {
+    return worldSize / 2.0f;
+  }
+  return fminf(fmaxf(centre, half), worldSize - half);
+}
+
+static void clampCamera() {
+  camera.zoom = fminf(fmaxf(camera.zoom, layout.fitZoom), MAX_ZOOM);
+  camera.x = clampAxis(camera.x, viewWidth(), _state.width);
+  camera.y = clampAxis(camera.y, viewHeight(), _state.height);
+}
+
+void resetCamera() {
+  camera = (view_camera){.x = _state.width / 2.0f,
+                         .y = _state.height / 2.0f,
+                         .zoom = layout.fitZoom};
+}
+
+// Screen position of the centre of the view
+static Vector2 viewCentre() {
+  return (Vector2){layout.worldTopLeftX + viewWidth() / 2,
+                   layout.worldTopLeftY + viewHeight() / 2};
+}
+
+// The point of the world under the screen position, in cells
+static Vector2 screenToWorld(float screenX, float screenY) {
+  Vector2 centre = viewCentre();
+  return (Vector2){camera.x + (screenX - centre.x) / camera.zoom,
+                   camera.y - (screenY - centre.y) / camera.zoom};
+}
+
+static Vector2 worldToScreen(float x, float y) {
+  Vector2 centre = viewCentre();
+  return (Vector2){centre.x + (x - camera.x) * camera.zoom,
+                   centre.y - (y - camera.y) * camera.zoom};
+}
+
+void zoomCamera(float factor, int screenX, int screenY) {
+  Vector2 fixed = screenToWorld(screenX, screenY);
+  Vector2 centre = viewCentre();
+  camera.zoom = fminf(fmaxf(camera.zoom * factor, layout.fitZoom), MAX_ZOOM);
+  camera.x = fixed.x - (screenX - centre.x) / camera.zoom;
+  camera.y = fixed.y + (screenY - centre.y) / camera.zoom;
+  clampCamera();
+}
+
+void panCamera(float dx, float dy) {
+  camera.x -= dx / camera.zoom;
+  camera.y += dy / camera.zoom;
+  clampCamera();
+}
+
+bool screenToCell(int screenX, int screenY, int *x, int *y) {
+  if (screenX < layout.worldTopLeftX || screenY < layout.worldTopLeftY ||
+      screenX >= layout.worldBottomRightX ||
+      screenY >= layout.worldBottomRightY) {
+    return false;
+  }
+  // The middle of the pixel, so a pixel on a cell edge picks a single cell
+  Vector2 point = screenToWorld(screenX + 0.5f, screenY + 0.5f);
+  *x = (int)floorf(point.x);
+  *y = (int)floorf(point.y);
+  return *x >= 0 && *y >= 0 && *x < _state.width && *y < _state.height;
+}
+
+Rectangle cellsToScreen(int minX, int minY, int maxX, int maxY) {
+  Vector2 topLeft = worldToScreen(minX, maxY + 1);
+  return (Rectangle){topLeft.x, topLeft.y,
+                     (maxX - minX + 1) * camera.zoom,
+                     (maxY - minY + 1) * camera.zoom};
+}
+
+// Coarsest level drawn at a pixel or more per texel, so no cell is skipped
+static int levelForZoom(float zoom) {
+  int level = 0;
+  while (level + 1 < LOD_LEVELS && zoom * (1 << level) < 1) {
+    level++;
+  }
+  return level;
+}
+
+// Rewrite the level 0 texels of the chunk from its cells
+static void writeCells(const world_frame *frame, int index) {
+  cell_rect rect = chunkTexels(&levels[0], 0, index);
+  for (int y = rect.minY; y <= rect.maxY; y++) {
+    const Block *row = &frame->cells[(size_t)y * frame->width];
+    BlockColorsRow(&row[rect.minX], rect.maxX - rect.minX + 1,
+                   &texelRow(&levels[0], y)[rect.minX]);
+  }
+  chunksWritten++;
+}
+
+// Rewrite the texels of the chunk in the level from the level below, each the
+// average of the 2x2 texels under it. Past the right and top edges of an odd
+// sized level the last column and row are counted twice, which averages to
+// the same as leaving them out
+static void downsampleChunk(int level, int index) {
+  const lod_level *below = &levels[level - 1];
+  lod_level *lod = &levels[level];
+  cell_rect rect = chunkTexels(lod, level, index);
+  for (int y = rect.minY; y <= rect.maxY; y++) {
+    const Color *bottom = texelRow(below, y * 2);
+    // The top row of an odd height level only covers one row below
+    const Color *top =
+        y * 2 + 1 < below->height ? texelRow(below, y * 2 + 1) : bottom;
+    Color *out = texelRow(lod, y);
+    for (int x = rect.minX; x <= rect.maxX; x++) {
+      int left = x * 2;
+      int right = min(left + 1, below->width - 1);
+      Color c[4] = {bottom[left], bottom[right], top[left], top[right]};
+      out[x] = (Color){(c[0].r + c[1].r + c[2].r + c[3].r) / 4,
+                       (c[0].g + c[1].g + c[2].g + c[3].g) / 4,
+                       (c[0].b + c[1].b + c[2].b + c[3].b) / 4,
+                       (c[0].a + c[1].a + c[2].a + c[3].a) / 4};
+    }
+  }
+}
+
+// Fill the texels of the chunk in the level with the colour of air
+static void fillChunk(int level, int index) {
+  lod_level *lod = &levels[level];
+  cell_rect rect = chunkTexels(lod, level, index);
+  for (int y = rect.minY; y <= rect.maxY; y++) {
+    Color *row = texelRow(lod, y);
+    for (int x = rect.minX; x <= rect.maxX; x++) {
+      row[x] = airColor;
+    }
+  }
+  chunksWritten++;
+}
+
+// Bring the chunk's texels in the level up to date with the frame, along with
+// the levels below it that they are made from. A chunk of nothing but air is
+// filled in the level alone
+static void refreshChunk(const world_frame *frame, int level, int index) {
+  lod_level *lod = &levels[level];
+  if (frame->chunkVersions[index] <= lod->written[index]) {
+    return;
+  }
+  if (fillAir && frame->emptyChunks[index]) {
+    fillChunk(level, index);
+  } else if (level == 0) {
+    writeCells(frame, index);
+  } else {
+    refreshChunk(frame, level - 1, index);
+    downsampleChunk(level, index);
+  }
+  lod->written[index] = frame->version;
+}
+
+// Upload the texels of the chunks minCx to maxCx in chunk row cy of the level
+static void uploadChunks(int level, int cy, int minCx, int maxCx) {
+  lod_level *lod = &levels[level];
+  cell_rect first = chunkTexels(lod, level, cy * _state.chunksX + minCx);
+  cell_rect last = chunkTexels(lod, level, cy * _state.chunksX + maxCx);
+  int width = last.maxX - first.minX + 1;
+  int height = first.maxY - first.minY + 1;
+  // The buffer holds the rows top first like the texture
+  for (int y = first.minY; y <= first.maxY; y++) {
+    memcpy(&uploadBuffer[(size_t)(first.maxY - y) * width],
+           &texelRow(lod, y)[first.minX], width * sizeof(Color));
+  }
+  Rectangle rect = {first.minX, lod->height - first.maxY - 1, width, height};
+  UpdateTextureRec(lod->texture, rect, uploadBuffer);
+
+  for (int cx = minCx; cx <= maxCx; cx++) {
+    int index = cy * _state.chunksX + cx;
+    lod->uploaded[index] = lod->written[index];
+  }
+}
+
+// Rewrite the chunks in the range that changed since their texels in the level
+// were written and upload them, until the frame's budget runs out. The chunks
+// from the first to the last one that changed in each chunk row are uploaded
+// together
+static void uploadChanges(const world_frame *frame, int level,
+                          const cell_rect *chunks) {
+  lod_level *lod = &levels[level];
+  int rows = chunks->maxY - chunks->minY + 1;
+  int first = nextChunkRow >= chunks->minY && nextChunkRow <= chunks->maxY
+                  ? nextChunkRow
+                  : chunks->minY;
+  chunksWritten = 0;
+  for (int i = 0; i < rows && chunksWritten < CHUNK_WRITE_BUDGET; i++) {
+    int cy = chunks->minY + (first - chunks->minY + i) % rows;
+    int minCx = INT_MAX;
+    int maxCx = INT_MIN;
+    for (int cx = chunks->minX; cx <= chunks->maxX; cx++) {
+      int index = cy * _state.chunksX + cx;
+      refreshChunk(frame, level, index);
+      if (lod->uploaded[index] != lod->written[index]) {
+        minCx = min(minCx, cx);
+        maxCx = max(maxCx, cx);
+      }
+    }
+    if (minCx <= maxCx) {
+      uploadChunks(level, cy, minCx, maxCx);
+    }
+    nextChunkRow = cy + 1;
+  }
+}
+
+// Lines between the cells in the visible rect, once they are far enough apart
+// to not hide the cells
+static void drawGrid(float minX, float minY, float maxX, float maxY) {
+  if (camera.zoom < GRID_MIN_ZOOM) {
+    return;
+  }
+  int tile = 0;
+  while (tile + 1 < GRID_TILES && GRID_MIN_ZOOM << (tile + 1) <= camera.zoom) {
+    tile++;
+  }
+  Texture2D grid = gridTiles[tile];
+  // Texel rows count down like the screen, so the top row of every tile lands
+  // on the top edge of a cell when the view's top edge is at -maxY tiles
+  Rectangle source = {minX * grid.width, -maxY * grid.height,
+                      (maxX - minX) * grid.width, (maxY - minY) * grid.height};
+  Vector2 topLeft = worldToScreen(minX, maxY);
+  Rectangle dest = {topLeft.x, topLeft.y, (maxX - minX) * camera.zoom,
+                    (maxY - minY) * camera.zoom};
+  DrawTexturePro(grid, source, dest, (Vector2){0, 0}, 0, WHITE);
+}
+
+void drawWorldTexture(const world_frame *frame) {
+  clampCamera();
+
+  // The part of the world in view, in cells
+  Vector2 viewMin = screenToWorld(layout.worldTopLeftX,
+                                  layout.worldBottomRightY);
+  Vector2 viewMax = screenToWorld(layout.worldBottomRightX,
+                                  layout.worldTopLeftY);
+  float minX = fmaxf(viewMin.x, 0);
+  float minY = fmaxf(viewMin.y, 0);
+  float maxX = fminf(viewMax.x, _state.width);
+  float maxY = fminf(viewMax.y, _state.height);
+  if (minX >= maxX || minY >= maxY) {
+    return;
+  }
+
+  int level = levelForZoom(camera.zoom);
+  cell_rect chunks = {
+      .minX = (int)minX / CHUNK_SIZE,
+      .minY = (int)minY / CHUNK_SIZE,
+      .maxX = min(((int)ceilf(maxX) - 1) / CHUNK_SIZE, _state.chunksX - 1),
+      .maxY = min(((int)ceilf(maxY) - 1) / CHUNK_SIZE, _state.chunksY - 1)};
+  uploadChanges(frame, level, &chunks);
+
+  const lod_level *lod = &levels[level];
+  float scale = 1 << level;
+  Rectangle source = {minX / scale, lod->height - maxY / scale,
+                      (maxX - minX) / scale, (maxY - minY) / scale};
+  Vector2 topLeft = worldToScreen(minX, maxY);
+  Rectangle dest = {topLeft.x, topLeft.y, (maxX - minX) * camera.zoom,
+                    (maxY - minY) * camera.zoom};
+
+  BeginScissorMode(layout.worldTopLeftX, layout.worldTopLeftY, viewWidth(),
+                   viewHeight());
+  DrawTexturePro(lod->texture, source, dest, (Vector2){0, 0}, 0, WHITE);
+  drawGrid(minX, minY, maxX, maxY);
+  EndScissorMode();
+}
+
+void unloadRenderer() {
+  for (int level = 0; level < LOD_LEVELS; level++) {
+    lod_level *lod = &levels[level];
+    if (lod->texture.id != 0) {
+      UnloadTexture(lod->texture);
+    }
+    free(lod->pixels);
+    free(lod->written);
+    free(lod->uploaded);
+    *lod = (lod_level){0};
+  }
+  free(uploadBuffer);
+  uploadBuffer = NULL;
+  for (int i = 0; i < GRID_TILES; i++) {
+    if (gridTiles[i].id != 0) {
+      UnloadTexture(gridTiles[i]);
+    }
+    gridTiles[i] = (Texture2D){0};
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "raylib.h"
+#include "sim.h"
+#include <stdbool.h>
+
+// Draws published world frames through a camera that pans and zooms over the
+// world, drawing only the cells in view. The colours are kept on the CPU as a
+// pyramid of levels, level 0 with a texel per cell and each level above with a
+// texel averaging 2x2 texels of the one below, each uploaded to a texture of
+// its own. When zoomed out past a pixel per cell the coarsest level with a
+// pixel or more per texel is drawn instead of the cells, so a whole 4096x4096
+// world is drawn from a 512x512 texture.
+//
+// Only the chunks in view that changed since their texels were last written
+// are rewritten, from the cells up to the level drawn, and only their texels
+// are uploaded, so a settled world costs almost nothing to draw whatever its
+// size and zoom.
+
+// Where the camera looks. Positions are in cells with y counting up from the
+// bottom of the world like the cells do
+typedef struct {
+  // The point of the world at the centre of the view
+  float x;
+  float y;
+  // Screen pixels per cell, from layout.fitZoom up to MAX_ZOOM
+  float zoom;
+} view_camera;
+
+extern view_camera camera;
+
+// Create the world textures for the current world size and layout and show
+// the whole world. Needs an open window. Returns false if a texture can't be
+// created
+bool initRenderer();
+
+// Rewrite and upload every cell on the next frame
+void invalidateRenderer();
+
+// Zoom out to show the whole world
+void resetCamera();
+
+// Multiply the zoom by factor, keeping the point under the screen position
+// where it is
+void zoomCamera(float factor, int screenX, int screenY);
+
+// Move the world by dx, dy screen pixels, like dragging it
+void panCamera(float dx, float dy);
+
+// Find the cell under the screen position. Returns false if there is none
+// because the position is outside the view or the world
+bool screenToCell(int screenX, int screenY, int *x, int *y);
+
+// Screen rect covering the cells from minX, minY to maxX, maxY inclusive
+Rectangle cellsToScreen(int minX, int minY, int maxX, int maxY);
+
+// Upload the cells in view that changed in the frame and draw the world and
+// grid in the layout's view
+void drawWorldTexture(const world_frame *frame);
+
+void unloadRenderer();
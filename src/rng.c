@@ -23,3 +23,10 @@ void pcg32_init(uint64_t seed) {
   state = seed + increment;
   (void)pcg32();
 }
+
+void cellRandomRow(uint64_t key, int x, int y, int count, rng_stream stream,
+                   uint64_t *out) {
+  for (int i = 0; i < count; i++) {
+    out[i] = cellRandom(key, x + i, y, stream);
+  }
+}
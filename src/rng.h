@@ -16,3 +16,46 @@ bool pcg32_bool(void);
 float pcg32_float(void);
 
 void pcg32_init(uint64_t seed);
+
+// Scramble a 64-bit value, used to derive unrelated seeds from related inputs
+// https://prng.di.unimi.it/splitmix64.c
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Counter-based generator for the tick. There is no state to advance: the
+// random value for a decision is a hash of the game seed, the tick, the cell
+// position and which decision it is, so every cell gets the same value on any
+// thread and in any visiting order.
+// https://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+
+// Independent streams for the different decisions a cell can make
+typedef enum { RNG_STREAM_PICK_SIDE, RNG_STREAM_FLUID_DIR } rng_stream;
+
+// Key for every random value of one tick
+static inline uint64_t tickRandomKey(uint64_t seed, uint64_t tick) {
+  return splitmix64(seed ^ splitmix64(tick));
+}
+
+static inline uint64_t cellRandom(uint64_t key, int x, int y,
+                                  rng_stream stream) {
+  uint64_t counter =
+      ((uint64_t)(uint32_t)y << 32 | (uint32_t)x) << 2 | (uint64_t)stream;
+  return splitmix64(key ^ counter);
+}
+
+static inline bool cellRandomBool(uint64_t key, int x, int y,
+                                  rng_stream stream) {
+  return cellRandom(key, x, y, stream) >> 63;
+}
+
+// The random values of count cells of row y starting at x, written to out,
+// the same as cellRandom gives for each of them. Written as a plain loop over
+// independent hashes so it vectorizes on targets with 64-bit vector
+// multiplies, such as with -mavx512dq, for code that needs the values of a
+// whole span at once
+void cellRandomRow(uint64_t key, int x, int y, int count, rng_stream stream,
+                   uint64_t *out);
@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "sim.h"
+#include "census.h"
+#include "changes.h"
+#include "chunk.h"
+#include "consts.h"
+#include "journal.h"
+#include "record.h"
+#include "state.h"
+#include "utils.h"
+#include "world.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum {
+  // Must be a power of two
+  COMMAND_QUEUE_SIZE = 1024,
+  // At most this many ticks are run to catch up after a slow tick, the rest
+  // of the time is dropped
+  MAX_CATCH_UP_TICKS = 5,
+  // Longest the thread sleeps before checking for commands again
+  COMMAND_POLL_NS = 2000000,
+  FRAME_COUNT = 3,
+  // Set on the shared frame index when it holds a frame the reader has not
+  // taken yet
+  FRAME_FRESH = 4,
+};
+
+#define TICK_SECONDS (1.0 / PHYSICS_FPS)
+
+static struct {
+  pthread_t thread;
+  bool running;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t idle;
+  bool active;
+  bool isIdle;
+  bool stopping;
+
+  // Single producer, single consumer ring. The main thread only writes tail
+  // and the simulation thread only writes head
+  sim_command commands[COMMAND_QUEUE_SIZE];
+  size_t head;
+  size_t tail;
+
+  // Only used by the simulation thread
+  bool paused;
+  uint64_t version;
+  uint64_t *chunkVersions;
+  change_cursor changes;
+
+  // Triple buffer. The writer owns back, the reader owns front and the third
+  // frame is swapped through shared
+  world_frame frames[FRAME_COUNT];
+  int back;
+  int front;
+  int shared;
+} sim;
+
+static double nowSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void freeFrames(void) {
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    free(sim.frames[i].cells);
+    free(sim.frames[i].chunkVersions);
+    free(sim.frames[i].emptyChunks);
+    sim.frames[i] = (world_frame){0};
+  }
+  free(sim.chunkVersions);
+  sim.chunkVersions = NULL;
+}
+
+static bool allocFrames(void) {
+  freeFrames();
+  size_t cells = (size_t)_state.width * _state.height;
+  size_t chunks = (size_t)_state.chunksX * _state.chunksY;
+  sim.chunkVersions = calloc(chunks, sizeof(uint64_t));
+  bool ok = sim.chunkVersions != NULL;
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    world_frame *frame = &sim.frames[i];
+    frame->width = _state.width;
+    frame->height = _state.height;
+    frame->cells = malloc(cells * sizeof(Block));
+    frame->chunkVersions = calloc(chunks, sizeof(uint64_t));
+    frame->emptyChunks = calloc(chunks, sizeof(bool));
+    ok = ok && frame->cells != NULL && frame->chunkVersions != NULL &&
+         frame->emptyChunks != NULL;
+  }
+  if (!ok) {
+    freeFrames();
+  }
+  return ok;
+}
+
+// Give every chunk that changed since the last call a new version
+static void markChangedChunks(void) {
+  sim.version++;
+  world_change changes[CHANGE_BATCH];
+  int count;
+  while ((count = changesRead(&sim.changes, changes, CHANGE_BATCH)) != 0) {
+    if (count < 0) {
+      int chunks = _state.chunksX * _state.chunksY;
+      for (int i = 0; i < chunks; i++) {
+        sim.chunkVersions[i] = sim.version;
+      }
+    }
+    for (int i = 0; i < count; i++) {
+      sim.chunkVersions[changes[i].chunk] = sim.version;
+    }
+  }
+}
+
+// Copy the chunks that changed since the back frame was last written into it
+// and swap it with the shared frame
+static void publishFrame(void) {
+  world_frame *frame = &sim.frames[sim.back];
+  censusRefresh();
+  uint32_t notAir = ((1u << BLOCK_TYPES_COUNT) - 1) & ~(1u << AIR);
+  for (int cy = 0; cy < _state.chunksY; cy++) {
+    int minY = cy * CHUNK_SIZE;
+    int maxY = min(minY + CHUNK_SIZE, _state.height) - 1;
+    for (int cx = 0; cx < _state.chunksX; cx++) {
+      int index = cy * _state.chunksX + cx;
+      if (sim.chunkVersions[index] <= frame->version) {
+        continue;
+      }
+      int minX = cx * CHUNK_SIZE;
+      int width = min(minX + CHUNK_SIZE, _state.width) - minX;
+      for (int y = minY; y <= maxY; y++) {
+        size_t offset = (size_t)y * _state.width + minX;
+        memcpy(&frame->cells[offset], &_state.world[offset],
+               width * sizeof(Block));
+      }
+      frame->emptyChunks[index] = !censusChunkHolds(index, notAir);
+    }
+  }
+  memcpy(frame->chunkVersions, sim.chunkVersions,
+         (size_t)_state.chunksX * _state.chunksY * sizeof(uint64_t));
+  frame->version = sim.version;
+  frame->tick = _state.tick;
+  censusTotals(frame->materialCounts);
+
+  int old = __atomic_exchange_n(&sim.shared, sim.back | FRAME_FRESH,
+                                __ATOMIC_ACQ_REL);
+  sim.back = old & ~FRAME_FRESH;
+}
+
+static void tick(void) {
+  worldTick();
+  journalTick();
+  markChangedChunks();
+}
+
+// Apply every queued command. Edits queued while a tick runs wait for it to
+// finish, so they always land between ticks. Returns true if any of them
+// changed the world
+static bool applyCommands(void) {
+  size_t tail = __atomic_load_n(&sim.tail, __ATOMIC_ACQUIRE);
+  size_t head = sim.head;
+  bool changed = false;
+  for (; head != tail; head++) {
+    const sim_command *command = &sim.commands[head & (COMMAND_QUEUE_SIZE - 1)];
+    switch (command->type) {
+    case SIM_EDIT:
+      recordEdit(&command->edit);
+      applyEdit(&command->edit);
+      changed = true;
+      break;
+    case SIM_PAUSE:
+      sim.paused = command->value;
+      recordEvent(EVENT_PAUSE, sim.paused);
+      break;
+    case SIM_STEP:
+      if (sim.paused) {
+        recordEvent(EVENT_STEP, 0);
+        tick();
+        changed = true;
+      }
+      break;
+    case SIM_CHECKPOINT:
+      recordEvent(EVENT_CHECKPOINT, 0);
+      journalCheckpoint();
+      break;
+    case SIM_UNDO:
+      recordEvent(EVENT_UNDO, 0);
+      changed = journalUndo() || changed;
+      break;
+    case SIM_REDO:
+      recordEvent(EVENT_REDO, 0);
+      changed = journalRedo() || changed;
+      break;
+    }
+  }
+  // Let the main thread reuse the slots
+  __atomic_store_n(&sim.head, head, __ATOMIC_RELEASE);
+  if (changed) {
+    journalSync();
+    markChangedChunks();
+  }
+  return changed;
+}
+
+// Wait while the simulation is inactive. Returns false when it should stop
+static bool waitUntilActive(bool *resumed) {
+  pthread_mutex_lock(&sim.lock);
+  *resumed = false;
+  if (!sim.active && !sim.stopping) {
+    if (applyCommands()) {
+      publishFrame();
+    }
+    sim.isIdle = true;
+    pthread_cond_broadcast(&sim.idle);
+    while (!sim.active && !sim.stopping) {
+      pthread_cond_wait(&sim.wake, &sim.lock);
+    }
+    sim.isIdle = false;
+    *resumed = true;
+  }
+  bool stopping = sim.stopping;
+  pthread_mutex_unlock(&sim.lock);
+  return !stopping;
+}
+
+static void *simMain(void *_) {
+  (void)_;
+  double last = nowSeconds();
+  double pending = 0;
+  bool resumed;
+  while (waitUntilActive(&resumed)) {
+    bool changed = applyCommands();
+
+    // Fixed time step. Time spent inactive or paused is not made up for
+    double now = nowSeconds();
+    if (!resumed && !sim.paused) {
+      pending = min(pending + now - last, MAX_CATCH_UP_TICKS * TICK_SECONDS);
+    }
+    last = now;
+    while (pending >= TICK_SECONDS) {
+      tick();
+      pending -= TICK_SECONDS;
+      changed = true;
+    }
+    if (changed) {
+      publishFrame();
+    }
+
+    double untilTick = sim.paused ? 1 : TICK_SECONDS - pending;
+    long sleepNs = min((long)(untilTick * 1e9), (long)COMMAND_POLL_NS);
+    nanosleep(&(struct timespec){.tv_sec = 0, .tv_nsec = sleepNs}, NULL);
+  }
+  return NULL;
+}
+
+bool simWorldReplaced(void) {
+  world_frame *frame = &sim.frames[0];
+  if (frame->cells == NULL || frame->width != _state.width ||
+      frame->height != _state.height) {
+    if (!allocFrames()) {
+      return false;
+    }
+  }
+
+  // Everything is new, so every frame has to be written in full
+  sim.changes = changesSubscribe();
+  sim.version++;
+  int count = _state.chunksX * _state.chunksY;
+  for (int i = 0; i < count; i++) {
+    sim.chunkVersions[i] = sim.version;
+  }
+  for (int i = 0; i < FRAME_COUNT; i++) {
+    sim.frames[i].version = 0;
+  }
+  sim.back = 0;
+  sim.shared = 1;
+  sim.front = 2;
+  publishFrame();
+  return true;
+}
+
+bool simStart(void) {
+  simStop();
+  sim.head = sim.tail = 0;
+  sim.version = 0;
+  sim.paused = false;
+  if (!simWorldReplaced()) {
+    return false;
+  }
+
+  pthread_mutex_init(&sim.lock, NULL);
+  pthread_cond_init(&sim.wake, NULL);
+  pthread_cond_init(&sim.idle, NULL);
+  sim.active = false;
+  sim.isIdle = false;
+  sim.stopping = false;
+  if (pthread_create(&sim.thread, NULL, simMain, NULL) != 0) {
+    freeFrames();
+    return false;
+  }
+  sim.running = true;
+  return true;
+}
+
+void simStop(void) {
+  if (!sim.running) {
+    return;
+  }
+  pthread_mutex_lock(&sim.lock);
+  sim.stopping = true;
+  pthread_cond_broadcast(&sim.wake);
+  pthread_mutex_unlock(&sim.lock);
+  pthread_join(sim.thread, NULL);
+
+  pthread_mutex_destroy(&sim.lock);
+  pthread_cond_destroy(&sim.wake);
+  pthread_cond_destroy(&sim.idle);
+  freeFrames();
+  sim.running = false;
+}
+
+void simSetActive(bool active) {
+  pthread_mutex_lock(&sim.lock);
+  sim.active = active;
+  if (active) {
+    pthread_cond_broadcast(&sim.wake);
+  } else {
+    while (!sim.isIdle) {
+      pthread_cond_wait(&sim.idle, &sim.lock);
+    }
+  }
+  pthread_mutex_unlock(&sim.lock);
+}
+
+bool simPush(const sim_command *command) {
+  size_t head = __atomic_load_n(&sim.head, __ATOMIC_ACQUIRE);
+  if (sim.tail - head == COMMAND_QUEUE_SIZE) {
+    return false;
+  }
+  sim.commands[sim.tail & (COMMAND_QUEUE_SIZE - 1)] = *command;
+  __atomic_store_n(&sim.tail, sim.tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+const world_frame *simLatestFrame(void) {
+  if (__atomic_load_n(&sim.shared, __ATOMIC_RELAXED) & FRAME_FRESH) {
+    sim.front =
+        __atomic_exchange_n(&sim.shared, sim.front, __ATOMIC_ACQ_REL) &
+        ~FRAME_FRESH;
+  }
+  return &sim.frames[sim.front];
+}
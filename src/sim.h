@@ -0,0 +1,78 @@
+#pragma once
+
+#include "block.h"
+#include "edit.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Runs the simulation on its own thread at a fixed tick rate, so a slow tick
+// never stalls rendering or input. Edits are handed to the thread through a
+// command queue and every completed step is published as a frame through a
+// triple buffer, so neither side ever waits for the other.
+//
+// While the simulation is active the world must only be touched by its thread.
+// Deactivating it waits until the thread is idle, after which the world can be
+// used directly again, for example to start a new game or load one.
+
+typedef enum {
+  // Apply edit to the world before the next tick
+  SIM_EDIT,
+  // Stop ticking when value is 1, carry on when it is 0. Edits still apply
+  // while paused
+  SIM_PAUSE,
+  // Run a single tick while paused
+  SIM_STEP,
+  // Start a new undo step, so the edits after it can be undone together
+  SIM_CHECKPOINT,
+  // Return the world to the start of the last undo step
+  SIM_UNDO,
+  // Reverse the last undo
+  SIM_REDO,
+} sim_command_type;
+
+typedef struct {
+  sim_command_type type;
+  int value;
+  world_edit edit;
+} sim_command;
+
+// A published copy of the world. Only read it from the thread that called
+// simLatestFrame, until it calls simLatestFrame again
+typedef struct {
+  int width;
+  int height;
+  Block *cells;
+  // Value of version when each chunk last changed, stored like the chunks.
+  // Every chunk that differs between two frames has a version above the older
+  // frame's version
+  uint64_t *chunkVersions;
+  // Whether each chunk holds nothing but air, stored like the chunks
+  bool *emptyChunks;
+  uint64_t version;
+  uint64_t tick;
+  // Cells of each material in the world, see census.h
+  uint64_t materialCounts[BLOCK_TYPES_COUNT];
+} world_frame;
+
+// Start the simulation thread for the current world. It starts inactive.
+// Returns false if the thread or the frames can't be created
+bool simStart(void);
+
+// Stop and join the simulation thread
+void simStop(void);
+
+// Activate or deactivate the simulation. Deactivating applies every queued
+// command and then waits until the thread is idle
+void simSetActive(bool active);
+
+// Publish the world again after it was replaced while the simulation was
+// inactive, reallocating the frames if its size changed. Returns false if they
+// can't be allocated
+bool simWorldReplaced(void);
+
+// Queue a command from the main thread. Returns false and drops the command if
+// the queue is full
+bool simPush(const sim_command *command);
+
+// The most recently published frame
+const world_frame *simLatestFrame(void);
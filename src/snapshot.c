@@ -0,0 +1,237 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include "snapshot.h"
+#include "block.h"
+#include "bytes.h"
+#include "cells.h"
+#include "chunk.h"
+#include "rng.h"
+#include "state.h"
+#include "utils.h"
+#include "world.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "SNDS"
+
+// Version 3 added the velocity bits of the cells. Version 2 files are the
+// same with the velocity always 0, so they still load
+enum { SNAPSHOT_VERSION = 3, OLDEST_SNAPSHOT_VERSION = 2 };
+
+// Header fields, in file order
+typedef struct {
+  int width;
+  int height;
+  int placeWidth;
+  int selectedBlockType;
+  uint64_t tick;
+  uint64_t seed;
+  uint64_t rng;
+} snapshot_header;
+
+// Bounds of chunk (cx, cy), clipped to the world
+static cell_rect chunkBounds(int cx, int cy) {
+  int minX = cx * CHUNK_SIZE;
+  int minY = cy * CHUNK_SIZE;
+  return (cell_rect){.minX = minX,
+                     .minY = minY,
+                     .maxX = min(minX + CHUNK_SIZE, _state.width) - 1,
+                     .maxY = min(minY + CHUNK_SIZE, _state.height) - 1};
+}
+
+static void putChunk(FILE *file, const cell_rect *bounds) {
+  uint8_t data[MAX_ENCODED_CHUNK_SIZE];
+  size_t size = encodeChunk(getBlock(bounds->minX, bounds->minY),
+                            _state.width, bounds->maxX - bounds->minX + 1,
+                            bounds->maxY - bounds->minY + 1, data);
+  fwrite(data, 1, size, file);
+}
+
+bool saveGame(const char *path) {
+  // Write next to the old save and swap it in at the end, so a failed save
+  // never destroys the last good one
+  size_t tempSize = strlen(path) + sizeof(".tmp");
+  char *tempPath = malloc(tempSize);
+  if (tempPath == NULL) {
+    return false;
+  }
+  snprintf(tempPath, tempSize, "%s.tmp", path);
+
+  FILE *file = fopen(tempPath, "wb");
+  if (file == NULL) {
+    free(tempPath);
+    return false;
+  }
+
+  fputs(SNAPSHOT_MAGIC, file);
+  putU8(file, SNAPSHOT_VERSION);
+  putU16(file, _state.width);
+  putU16(file, _state.height);
+  putU16(file, _state.placeWidth);
+  putU8(file, _state.selectedBlockType);
+  putU64(file, _state.tick);
+  putU64(file, _state.seed);
+  putU64(file, state);
+
+  for (int cy = 0; cy < _state.chunksY; cy++) {
+    for (int cx = 0; cx < _state.chunksX; cx++) {
+      cell_rect bounds = chunkBounds(cx, cy);
+      putChunk(file, &bounds);
+    }
+  }
+
+  bool ok = !ferror(file);
+  ok = fclose(file) == 0 && ok;
+  ok = ok && rename(tempPath, path) == 0;
+  if (!ok) {
+    remove(tempPath);
+  }
+  free(tempPath);
+  return ok;
+}
+
+// Reads from the mapped file. Every read fails once the end is passed
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+} reader;
+
+static bool getBytes(reader *r, size_t count, const uint8_t **bytes) {
+  if (r->size - r->pos < count) {
+    return false;
+  }
+  *bytes = r->data + r->pos;
+  r->pos += count;
+  return true;
+}
+
+static bool getU8(reader *r, uint8_t *value) {
+  const uint8_t *b;
+  if (!getBytes(r, 1, &b)) {
+    return false;
+  }
+  *value = b[0];
+  return true;
+}
+
+static bool getU16(reader *r, uint16_t *value) {
+  const uint8_t *b;
+  if (!getBytes(r, 2, &b)) {
+    return false;
+  }
+  *value = b[0] | b[1] << 8;
+  return true;
+}
+
+static bool getU64(reader *r, uint64_t *value) {
+  const uint8_t *b;
+  if (!getBytes(r, 8, &b)) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 7; i >= 0; i--) {
+    *value = *value << 8 | b[i];
+  }
+  return true;
+}
+
+static bool getHeader(reader *r, snapshot_header *header) {
+  const uint8_t *magic;
+  uint8_t version, selected;
+  uint16_t width, height, placeWidth;
+  if (!getBytes(r, strlen(SNAPSHOT_MAGIC), &magic) ||
+      memcmp(magic, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) != 0 ||
+      !getU8(r, &version) || version < OLDEST_SNAPSHOT_VERSION ||
+      version > SNAPSHOT_VERSION ||
+      !getU16(r, &width) || !getU16(r, &height) ||
+      !getU16(r, &placeWidth) || !getU8(r, &selected) ||
+      !getU64(r, &header->tick) || !getU64(r, &header->seed) ||
+      !getU64(r, &header->rng)) {
+    return false;
+  }
+  if (selected >= BLOCK_TYPES_COUNT || placeWidth < 1 ||
+      width < MIN_WORLD_SIZE || width > MAX_WORLD_SIZE ||
+      height < MIN_WORLD_SIZE || height > MAX_WORLD_SIZE) {
+    return false;
+  }
+  header->width = width;
+  header->height = height;
+  header->placeWidth = placeWidth;
+  header->selectedBlockType = selected;
+  return true;
+}
+
+// Decode the chunks of a world of the given size. With write unset it only
+// checks them, so a bad file is found before the world is touched
+static bool getChunks(reader *r, int width, int height, bool write) {
+  int chunksX = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  int chunksY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  for (int cy = 0; cy < chunksY; cy++) {
+    int minY = cy * CHUNK_SIZE;
+    int maxY = min(minY + CHUNK_SIZE, height) - 1;
+    for (int cx = 0; cx < chunksX; cx++) {
+      int minX = cx * CHUNK_SIZE;
+      int maxX = min(minX + CHUNK_SIZE, width) - 1;
+      Block *cells =
+          write ? &_state.world[(size_t)minY * width + minX] : NULL;
+      size_t used = decodeChunk(r->data + r->pos, r->size - r->pos, cells,
+                                width, maxX - minX + 1, maxY - minY + 1);
+      if (used == 0) {
+        return false;
+      }
+      r->pos += used;
+    }
+  }
+  return r->pos == r->size;
+}
+
+bool loadGame(const char *path, void (*beforeReplace)(void)) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  // Mapping the file lets the decoder read it in place without copying it
+  // into a buffer first
+  void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  reader r = {.data = data, .size = info.st_size, .pos = 0};
+  snapshot_header header;
+  bool ok = getHeader(&r, &header);
+  size_t chunksStart = r.pos;
+  ok = ok && getChunks(&r, header.width, header.height, false);
+  if (ok && (header.width != _state.width || header.height != _state.height)) {
+    ok = initWorld(header.width, header.height);
+  }
+  if (ok && beforeReplace != NULL) {
+    beforeReplace();
+  }
+  if (ok) {
+    r.pos = chunksStart;
+    getChunks(&r, header.width, header.height, true);
+    _state.placeWidth = header.placeWidth;
+    _state.selectedBlockType = header.selectedBlockType;
+    _state.tick = header.tick;
+    _state.seed = header.seed;
+    state = header.rng;
+    refreshWorld();
+  }
+
+  munmap(data, info.st_size);
+  return ok;
+}
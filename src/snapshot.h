@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Saving and loading the whole game state: the world, the brush, the tick
+// count and the RNG state, so a loaded game carries on exactly as the saved one
+// would have.
+//
+// The file starts with "SNDS", a version byte, the width, height and brush
+// width as u16, the selected block type as a u8, then the tick count, tick
+// seed and RNG state as u64. The chunks follow row by row. A chunk whose cells
+// are all the same is a kind byte of 0 and that cell. Any other chunk is a kind
+// byte of 1 followed by its rows from the bottom, each a list of runs of a u8
+// length and a cell. A cell is its type byte and a byte holding the variant in
+// the low bits, then the movement direction and the velocity above it. All
+// numbers are little endian.
+
+// Write the game to the file. The file is only replaced once the new one is
+// complete. Returns false if it can't be written
+bool saveGame(const char *path);
+
+// Replace the game with the one saved in the file, resizing the world if it
+// has a different size. Returns false and leaves the game as it was if the
+// file can't be read, is not a valid save or the world can't be resized.
+// Unless it is NULL, beforeReplace is called once the load can no longer fail,
+// while the tick count and the RNG are still those of the old game
+bool loadGame(const char *path, void (*beforeReplace)(void));
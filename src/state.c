@@ -1,12 +1,27 @@
 #include "state.h"
+#include "journal.h"
+#include "rng.h"
+#include "stream.h"
+#include "world.h"
 
 game_state _state;
 
 void initGameState() {
-  _state = (game_state){.placeWidth = 1, .selectedBlockType = SAND};
-  for (int y = 0; y < WORLD_HEIGHT; y++) {
-    for (int x = 0; x < WORLD_WIDTH; x++) {
-      _state.world[y][x] = AIR_BLOCK;
-    }
+  // Starting over can be undone like an edit, unless the map outside of the
+  // world had to be thrown away with it
+  bool undoable = !streamReset();
+  if (undoable) {
+    journalCheckpoint();
+  }
+  _state.placeWidth = 1;
+  _state.selectedBlockType = SAND;
+  _state.tool = TOOL_BRUSH;
+  _state.tick = 0;
+  _state.seed = (uint64_t)pcg32() << 32 | pcg32();
+  clearWorld();
+  if (undoable) {
+    journalSync();
+  } else {
+    journalClear();
   }
 }
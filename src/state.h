@@ -1,11 +1,40 @@
 #pragma once
 #include "block.h"
+#include "chunk.h"
 #include "consts.h"
+#include <stdint.h>
+
+// What clicking in the world does
+typedef enum {
+  // Paint with a square brush while the button is held
+  TOOL_BRUSH,
+  // Fill the region of cells with the clicked cell's type
+  TOOL_FILL,
+  // Replace the clicked cell's type inside the region bounded by walls
+  TOOL_REPLACE,
+  TOOLS_COUNT
+} edit_tool;
 
 typedef struct {
   int placeWidth;
   enum BlockType selectedBlockType;
-  Block world[WORLD_HEIGHT][WORLD_WIDTH];
+  edit_tool tool;
+  int width;
+  int height;
+  // width * height cells stored row by row, allocated once by initWorld
+  Block *world;
+  // chunksX * chunksY chunks stored row by row, covering the world
+  int chunksX;
+  int chunksY;
+  chunk *chunks;
+  // Position of the world in the unbounded map in chunks, see stream.h
+  int originX;
+  int originY;
+  // Ticks run since the game was started
+  uint64_t tick;
+  // Seed of the random choices cells make during the tick, drawn from the
+  // global RNG when the game starts
+  uint64_t seed;
 } game_state;
 
 extern game_state _state;
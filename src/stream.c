@@ -0,0 +1,655 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "stream.h"
+#include "block.h"
+#include "cells.h"
+#include "chunk.h"
+#include "consts.h"
+#include "journal.h"
+#include "state.h"
+#include "utils.h"
+#include "world.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum {
+  CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE,
+  // The window stays this many chunks from the origin, which keeps every cell
+  // position of the map well inside an int
+  MAX_MAP_CHUNKS = 1 << 20,
+  MIN_BUCKETS = 256,
+  MAX_PATH_SIZE = 4096,
+};
+
+#define CHUNK_FILE_SUFFIX ".chunk"
+#define TEMP_DIR_TEMPLATE "/tmp/sandgame-XXXXXX"
+
+// A compressed chunk in the memory cache
+typedef struct cache_entry {
+  // Position of the chunk in the map
+  int mx;
+  int my;
+  uint8_t *data;
+  size_t size;
+  // Set when the chunk's file is older than data or missing
+  bool dirty;
+  // Next entry in the same bucket
+  struct cache_entry *next;
+  // Neighbours in the order of use
+  struct cache_entry *newer;
+  struct cache_entry *older;
+} cache_entry;
+
+static struct {
+  bool enabled;
+  char *dir;
+  // Set when dir was created by streamInit and is removed with the store
+  bool tempDir;
+  size_t budget;
+  // Memory held by the cached chunks
+  size_t used;
+
+  cache_entry **buckets;
+  size_t bucketCount;
+  size_t count;
+  cache_entry *newest;
+  cache_entry *oldest;
+  // Set once a chunk has been written to a file
+  bool wroteFiles;
+  // Whether the store may hold a copy of each chunk of the window, so one that
+  // becomes all air is deleted from it
+  bool *stored;
+  // Size of the chunk grid of the window stored was made for
+  int storedX;
+  int storedY;
+
+  // Guards everything above that the loader thread uses, which is the cache
+  // and the files
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t loader;
+  bool stopping;
+  // Bumped whenever a chunk is stored, deleted or moved into the window. The
+  // loader drops what it read if it changed in the meantime
+  uint64_t generation;
+  // Window the loader reads the surrounding chunks of, in map chunks
+  bool prefetchPending;
+  int prefetchX;
+  int prefetchY;
+  int prefetchWidth;
+  int prefetchHeight;
+} store;
+
+// Returns false if the data is not a valid chunk with nothing after it
+static bool decodeStoredChunk(const uint8_t *data, size_t size, Block *cells) {
+  return size != 0 && decodeChunk(data, size, cells, CHUNK_SIZE, CHUNK_SIZE,
+                                  CHUNK_SIZE) == size;
+}
+
+static void fillAir(Block *cells) {
+  for (int i = 0; i < CHUNK_CELLS; i++) {
+    cells[i] = AIR_BLOCK;
+  }
+}
+
+static bool isAirChunk(const Block *cells) {
+  for (int i = 0; i < CHUNK_CELLS; i++) {
+    if (cells[i].type != AIR) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether chunk (cx, cy) of the window is cut off by its edge
+static bool isClipped(int cx, int cy) {
+  return (cx + 1) * CHUNK_SIZE > _state.width ||
+         (cy + 1) * CHUNK_SIZE > _state.height;
+}
+
+// Copy the part of chunk (cx, cy) of the window that is inside the world
+// between the world and the CHUNK_SIZE rows of cells
+static void copyWindowChunk(int cx, int cy, Block *cells, bool toWorld) {
+  int minX = cx * CHUNK_SIZE;
+  int minY = cy * CHUNK_SIZE;
+  int width = min(CHUNK_SIZE, _state.width - minX);
+  int height = min(CHUNK_SIZE, _state.height - minY);
+  for (int y = 0; y < height; y++) {
+    Block *world = &_state.world[(size_t)(minY + y) * _state.width + minX];
+    Block *chunk = &cells[y * CHUNK_SIZE];
+    if (toWorld) {
+      memcpy(world, chunk, width * sizeof(Block));
+    } else {
+      memcpy(chunk, world, width * sizeof(Block));
+    }
+  }
+}
+
+static void chunkPath(char *path, int mx, int my, const char *suffix) {
+  snprintf(path, MAX_PATH_SIZE, "%s/%d_%d%s%s", store.dir, mx, my,
+           CHUNK_FILE_SUFFIX, suffix);
+}
+
+// Read the chunk's file into data, which has room for MAX_ENCODED_CHUNK_SIZE
+// bytes. Returns false if there is none
+static bool readChunkFile(int mx, int my, uint8_t *data, size_t *size) {
+  char path[MAX_PATH_SIZE];
+  chunkPath(path, mx, my, "");
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return false;
+  }
+  *size = fread(data, 1, MAX_ENCODED_CHUNK_SIZE, file);
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
+
+// Write the chunk's file. The old file is only replaced once the new one is
+// complete, so the loader never reads half of one
+static bool writeChunkFile(int mx, int my, const uint8_t *data, size_t size) {
+  char path[MAX_PATH_SIZE], tempPath[MAX_PATH_SIZE];
+  chunkPath(path, mx, my, "");
+  chunkPath(tempPath, mx, my, ".tmp");
+  FILE *file = fopen(tempPath, "wb");
+  if (file == NULL) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+  ok = ok && rename(tempPath, path) == 0;
+  if (!ok) {
+    remove(tempPath);
+  }
+  store.wroteFiles = store.wroteFiles || ok;
+  return ok;
+}
+
+static void deleteChunkFile(int mx, int my) {
+  char path[MAX_PATH_SIZE];
+  chunkPath(path, mx, my, "");
+  remove(path);
+}
+
+static void deleteChunkFiles(void) {
+  DIR *dir = opendir(store.dir);
+  if (dir == NULL) {
+    return;
+  }
+  char path[MAX_PATH_SIZE];
+  size_t suffixLength = strlen(CHUNK_FILE_SUFFIX);
+  struct dirent *file;
+  while ((file = readdir(dir)) != NULL) {
+    size_t length = strlen(file->d_name);
+    if (length > suffixLength &&
+        strcmp(file->d_name + length - suffixLength, CHUNK_FILE_SUFFIX) == 0) {
+      snprintf(path, sizeof(path), "%s/%s", store.dir, file->d_name);
+      remove(path);
+    }
+  }
+  closedir(dir);
+}
+
+static size_t bucketOf(int mx, int my, size_t bucketCount) {
+  uint64_t key = (uint64_t)(uint32_t)mx << 32 | (uint32_t)my;
+  key *= 0x9e3779b97f4a7c15ULL;
+  return (key >> 32) & (bucketCount - 1);
+}
+
+static cache_entry *findEntry(int mx, int my) {
+  if (store.bucketCount == 0) {
+    return NULL;
+  }
+  cache_entry *entry = store.buckets[bucketOf(mx, my, store.bucketCount)];
+  while (entry != NULL && (entry->mx != mx || entry->my != my)) {
+    entry = entry->next;
+  }
+  return entry;
+}
+
+static void unlinkUse(cache_entry *entry) {
+  if (entry->newer != NULL) {
+    entry->newer->older = entry->older;
+  } else {
+    store.newest = entry->older;
+  }
+  if (entry->older != NULL) {
+    entry->older->newer = entry->newer;
+  } else {
+    store.oldest = entry->newer;
+  }
+}
+
+static void markUsed(cache_entry *entry) {
+  entry->newer = NULL;
+  entry->older = store.newest;
+  if (store.newest != NULL) {
+    store.newest->newer = entry;
+  } else {
+    store.oldest = entry;
+  }
+  store.newest = entry;
+}
+
+static void removeEntry(cache_entry *entry) {
+  cache_entry **link =
+      &store.buckets[bucketOf(entry->mx, entry->my, store.bucketCount)];
+  while (*link != entry) {
+    link = &(*link)->next;
+  }
+  *link = entry->next;
+  unlinkUse(entry);
+  store.used -= entry->size;
+  store.count--;
+  free(entry->data);
+  free(entry);
+}
+
+// Double the bucket count once there are more entries than buckets
+static void growBuckets(void) {
+  if (store.count < store.bucketCount) {
+    return;
+  }
+  size_t bucketCount = max(store.bucketCount * 2, (size_t)MIN_BUCKETS);
+  cache_entry **buckets = calloc(bucketCount, sizeof(cache_entry *));
+  if (buckets == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < store.bucketCount; i++) {
+    cache_entry *entry = store.buckets[i];
+    while (entry != NULL) {
+      cache_entry *next = entry->next;
+      size_t bucket = bucketOf(entry->mx, entry->my, bucketCount);
+      entry->next = buckets[bucket];
+      buckets[bucket] = entry;
+      entry = next;
+    }
+  }
+  free(store.buckets);
+  store.buckets = buckets;
+  store.bucketCount = bucketCount;
+}
+
+// Write the least recently used chunks to their files and drop them until the
+// cache fits in the budget. A chunk that can't be written stays cached
+static void evictOverBudget(void) {
+  while (store.used > store.budget && store.oldest != NULL) {
+    cache_entry *entry = store.oldest;
+    if (entry->dirty &&
+        !writeChunkFile(entry->mx, entry->my, entry->data, entry->size)) {
+      return;
+    }
+    store.generation++;
+    removeEntry(entry);
+  }
+}
+
+// Cache a copy of the encoded chunk, replacing any cached one
+static void cacheChunk(int mx, int my, const uint8_t *data, size_t size,
+                       bool dirty) {
+  cache_entry *old = findEntry(mx, my);
+  if (old != NULL) {
+    removeEntry(old);
+  }
+  growBuckets();
+  cache_entry *entry = malloc(sizeof(cache_entry));
+  uint8_t *copy = malloc(size);
+  if (entry == NULL || copy == NULL || store.bucketCount == 0) {
+    free(entry);
+    free(copy);
+    // Better slow than lost, a dirty chunk goes straight to its file
+    if (dirty) {
+      writeChunkFile(mx, my, data, size);
+    }
+    return;
+  }
+  memcpy(copy, data, size);
+  *entry = (cache_entry){
+      .mx = mx, .my = my, .data = copy, .size = size, .dirty = dirty};
+  size_t bucket = bucketOf(mx, my, store.bucketCount);
+  entry->next = store.buckets[bucket];
+  store.buckets[bucket] = entry;
+  markUsed(entry);
+  store.used += size;
+  store.count++;
+  evictOverBudget();
+}
+
+static void clearCache(void) {
+  while (store.oldest != NULL) {
+    removeEntry(store.oldest);
+  }
+}
+
+// Decode the chunk at map position (mx, my) from the cache or its file into
+// cells, or fill them with air if it isn't stored. With keep unset the cached
+// copy is dropped because the window holds the chunk from now on. Returns
+// whether it was stored
+static bool fetchChunk(int mx, int my, Block *cells, bool keep) {
+  uint8_t data[MAX_ENCODED_CHUNK_SIZE];
+  size_t size;
+  bool found = false;
+  pthread_mutex_lock(&store.lock);
+  cache_entry *entry = findEntry(mx, my);
+  if (entry != NULL) {
+    found = decodeStoredChunk(entry->data, entry->size, cells);
+    if (keep) {
+      unlinkUse(entry);
+      markUsed(entry);
+    } else {
+      removeEntry(entry);
+    }
+  } else if (readChunkFile(mx, my, data, &size)) {
+    found = decodeStoredChunk(data, size, cells);
+  }
+  if (!keep) {
+    store.generation++;
+  }
+  pthread_mutex_unlock(&store.lock);
+  if (!found) {
+    fillAir(cells);
+  }
+  return found;
+}
+
+// Store the cells of map chunk (mx, my), or delete it if they are all air.
+// stored is the chunk's flag when it is in the window and NULL otherwise
+static void putChunk(int mx, int my, const Block *cells, bool *stored) {
+  pthread_mutex_lock(&store.lock);
+  store.generation++;
+  if (isAirChunk(cells)) {
+    if (stored == NULL || *stored) {
+      cache_entry *entry = findEntry(mx, my);
+      if (entry != NULL) {
+        removeEntry(entry);
+      }
+      deleteChunkFile(mx, my);
+    }
+  } else {
+    uint8_t data[MAX_ENCODED_CHUNK_SIZE];
+    size_t size = encodeChunk(cells, CHUNK_SIZE, CHUNK_SIZE, CHUNK_SIZE, data);
+    cacheChunk(mx, my, data, size, true);
+  }
+  pthread_mutex_unlock(&store.lock);
+}
+
+// Store chunk (cx, cy) of the window, merged with the stored cells outside of
+// the world when it is cut off by the edge
+static void stowChunk(int cx, int cy) {
+  Block cells[CHUNK_CELLS];
+  if (isClipped(cx, cy)) {
+    fetchChunk(_state.originX + cx, _state.originY + cy, cells, true);
+  }
+  copyWindowChunk(cx, cy, cells, false);
+  putChunk(_state.originX + cx, _state.originY + cy, cells,
+           &store.stored[cy * _state.chunksX + cx]);
+}
+
+static void loadChunk(int cx, int cy) {
+  Block cells[CHUNK_CELLS];
+  bool clipped = isClipped(cx, cy);
+  store.stored[cy * _state.chunksX + cx] = fetchChunk(
+      _state.originX + cx, _state.originY + cy, cells, clipped);
+  copyWindowChunk(cx, cy, cells, true);
+}
+
+// Whether (cx, cy) is a chunk of the window that isn't cut off by its edge
+static bool isWhole(int cx, int cy) {
+  return cx >= 0 && cy >= 0 && cx < _state.chunksX && cy < _state.chunksY &&
+         !isClipped(cx, cy);
+}
+
+// Whether chunk (cx, cy) of the window before moving by dx, dy chunks is
+// still in the window afterwards and whole in both
+static bool keptWhole(int cx, int cy, int dx, int dy) {
+  return isWhole(cx, cy) && isWhole(cx - dx, cy - dy);
+}
+
+// Move a grid of width x height elements so that the element at (x + dx,
+// y + dy) ends up at (x, y). Elements that come from outside are left as they
+// were
+static void shiftGrid(void *grid, size_t size, int width, int height, int dx,
+                      int dy) {
+  int rowLength = width - abs(dx);
+  if (rowLength <= 0 || abs(dy) >= height) {
+    return;
+  }
+  unsigned char *bytes = grid;
+  int fromX = max(dx, 0);
+  int toX = max(-dx, 0);
+  int minY = max(-dy, 0);
+  int maxY = min(height, height - dy) - 1;
+  // Rows move towards lower y when dy is positive, so go up from the bottom
+  for (int i = 0; i <= maxY - minY; i++) {
+    int y = dy > 0 ? minY + i : maxY - i;
+    memmove(&bytes[((size_t)y * width + toX) * size],
+            &bytes[((size_t)(y + dy) * width + fromX) * size],
+            (size_t)rowLength * size);
+  }
+}
+
+static void requestPrefetch(void) {
+  pthread_mutex_lock(&store.lock);
+  store.prefetchPending = true;
+  store.prefetchX = _state.originX;
+  store.prefetchY = _state.originY;
+  store.prefetchWidth = _state.chunksX;
+  store.prefetchHeight = _state.chunksY;
+  pthread_cond_signal(&store.wake);
+  pthread_mutex_unlock(&store.lock);
+}
+
+// Read the chunk at (mx, my) into the cache unless it is cached already. Called
+// with the lock held, which is released while the file is read
+static void prefetchChunk(int mx, int my) {
+  if (findEntry(mx, my) != NULL) {
+    return;
+  }
+  uint64_t generation = store.generation;
+  pthread_mutex_unlock(&store.lock);
+  uint8_t data[MAX_ENCODED_CHUNK_SIZE];
+  size_t size;
+  bool found = readChunkFile(mx, my, data, &size);
+  pthread_mutex_lock(&store.lock);
+  if (found && generation == store.generation && findEntry(mx, my) == NULL) {
+    cacheChunk(mx, my, data, size, false);
+  }
+}
+
+// Keeps the ring of chunks around the window in the cache
+static void *loaderMain(void *_) {
+  (void)_;
+  pthread_mutex_lock(&store.lock);
+  while (!store.stopping) {
+    if (!store.prefetchPending) {
+      pthread_cond_wait(&store.wake, &store.lock);
+      continue;
+    }
+    store.prefetchPending = false;
+    int minX = store.prefetchX - 1;
+    int minY = store.prefetchY - 1;
+    int maxX = store.prefetchX + store.prefetchWidth;
+    int maxY = store.prefetchY + store.prefetchHeight;
+    // A newer window or a stop replaces what is left of the ring
+    for (int my = minY; my <= maxY; my++) {
+      bool edgeRow = my == minY || my == maxY;
+      for (int mx = minX; mx <= maxX; mx += edgeRow ? 1 : maxX - minX) {
+        if (store.prefetchPending || store.stopping) {
+          break;
+        }
+        prefetchChunk(mx, my);
+      }
+    }
+  }
+  pthread_mutex_unlock(&store.lock);
+  return NULL;
+}
+
+bool streamInit(const char *dir, size_t budget) {
+  streamShutdown();
+  if (dir == NULL) {
+    char template[] = TEMP_DIR_TEMPLATE;
+    if (mkdtemp(template) == NULL) {
+      return false;
+    }
+    store.dir = strdup(template);
+    store.tempDir = true;
+  } else {
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    store.dir = strdup(dir);
+    store.tempDir = false;
+  }
+  if (store.dir == NULL) {
+    return false;
+  }
+
+  store.budget = budget;
+  store.stopping = false;
+  store.prefetchPending = false;
+  pthread_mutex_init(&store.lock, NULL);
+  pthread_cond_init(&store.wake, NULL);
+  if (pthread_create(&store.loader, NULL, loaderMain, NULL) != 0) {
+    pthread_mutex_destroy(&store.lock);
+    pthread_cond_destroy(&store.wake);
+    free(store.dir);
+    store.dir = NULL;
+    return false;
+  }
+  store.enabled = true;
+  streamReset();
+  return store.enabled;
+}
+
+void streamShutdown(void) {
+  if (!store.enabled) {
+    return;
+  }
+  pthread_mutex_lock(&store.lock);
+  store.stopping = true;
+  pthread_cond_signal(&store.wake);
+  pthread_mutex_unlock(&store.lock);
+  pthread_join(store.loader, NULL);
+  pthread_mutex_destroy(&store.lock);
+  pthread_cond_destroy(&store.wake);
+
+  clearCache();
+  deleteChunkFiles();
+  if (store.tempDir) {
+    rmdir(store.dir);
+  }
+  free(store.buckets);
+  free(store.stored);
+  free(store.dir);
+  store.buckets = NULL;
+  store.bucketCount = 0;
+  store.stored = NULL;
+  store.dir = NULL;
+  store.enabled = false;
+}
+
+void streamReadChunk(int mx, int my, Block *cells) {
+  if (!store.enabled) {
+    fillAir(cells);
+    return;
+  }
+  fetchChunk(mx, my, cells, true);
+}
+
+void streamWriteChunk(int mx, int my, const Block *cells) {
+  if (!store.enabled) {
+    return;
+  }
+  int cx = mx - _state.originX;
+  int cy = my - _state.originY;
+  bool *stored = NULL;
+  if (cx >= 0 && cy >= 0 && cx < _state.chunksX && cy < _state.chunksY) {
+    stored = &store.stored[cy * _state.chunksX + cx];
+    *stored = true;
+  }
+  putChunk(mx, my, cells, stored);
+}
+
+bool streamScroll(int dx, int dy) {
+  if (!store.enabled) {
+    return false;
+  }
+  // initWorld replaced the window with one of another size without a reset,
+  // so the flags don't fit it. Neither does anything stored around the old one
+  if (store.storedX != _state.chunksX || store.storedY != _state.chunksY) {
+    streamReset();
+    if (!store.enabled) {
+      return false;
+    }
+  }
+  long originX = (long)_state.originX + dx;
+  long originY = (long)_state.originY + dy;
+  if (labs(originX) + _state.chunksX > MAX_MAP_CHUNKS ||
+      labs(originY) + _state.chunksY > MAX_MAP_CHUNKS) {
+    return false;
+  }
+
+  // The steps from here on are saved at the new window position
+  journalCheckpoint();
+  for (int cy = 0; cy < _state.chunksY; cy++) {
+    for (int cx = 0; cx < _state.chunksX; cx++) {
+      if (!keptWhole(cx, cy, dx, dy)) {
+        stowChunk(cx, cy);
+      }
+    }
+  }
+  shiftGrid(_state.world, sizeof(Block), _state.width, _state.height,
+            dx * CHUNK_SIZE, dy * CHUNK_SIZE);
+  shiftGrid(store.stored, sizeof(bool), _state.chunksX, _state.chunksY, dx,
+            dy);
+  _state.originX = originX;
+  _state.originY = originY;
+  for (int cy = 0; cy < _state.chunksY; cy++) {
+    for (int cx = 0; cx < _state.chunksX; cx++) {
+      // The chunk was at (cx + dx, cy + dy) before the move
+      if (!keptWhole(cx + dx, cy + dy, dx, dy)) {
+        loadChunk(cx, cy);
+      }
+    }
+  }
+
+  refreshWorld();
+  journalWindowMoved();
+  requestPrefetch();
+  return true;
+}
+
+bool streamReset(void) {
+  if (!store.enabled) {
+    return false;
+  }
+  pthread_mutex_lock(&store.lock);
+  bool discarded = store.count > 0 || store.wroteFiles ||
+                   _state.originX != 0 || _state.originY != 0;
+  clearCache();
+  deleteChunkFiles();
+  store.wroteFiles = false;
+  store.generation++;
+  _state.originX = 0;
+  _state.originY = 0;
+  free(store.stored);
+  store.stored = calloc((size_t)_state.chunksX * _state.chunksY, sizeof(bool));
+  store.storedX = _state.chunksX;
+  store.storedY = _state.chunksY;
+  pthread_mutex_unlock(&store.lock);
+  if (store.stored == NULL) {
+    // Without the flags a chunk could come back after it was cleared
+    streamShutdown();
+    return discarded;
+  }
+  requestPrefetch();
+  return discarded;
+}
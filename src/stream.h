@@ -0,0 +1,52 @@
+#pragma once
+
+#include "block.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// The world is a window onto an unbounded map of chunks. The cells inside the
+// window are the world the tick and everything else work on, at the chunk
+// position _state.originX, _state.originY of the map. Scrolling the window
+// stows the chunks that leave it in the chunk store and fetches the ones that
+// enter it. Cells stop at the edges of the window like they do at the edges of
+// any world, until it moves on.
+//
+// The store keeps chunks compressed in a hash map from their map position,
+// with a cache of recently used ones in memory up to a budget. The least
+// recently used ones are written to a file each in the store directory when
+// the cache is full. A loader thread reads the chunks just outside the window
+// back into the cache ahead of time, so scrolling rarely waits for the disk.
+// Chunks that are all air are never stored.
+//
+// A chunk is stored in the same encoding as the chunks of saved games, see
+// cells.h.
+//
+// Every function does nothing until streamInit succeeds. The world must only
+// be used by the calling thread while they run.
+
+// Start an empty store in dir, keeping up to budget bytes of chunks in memory.
+// With dir NULL a temporary directory is used and removed by streamShutdown.
+// Returns false if the directory or the loader thread can't be created
+bool streamInit(const char *dir, size_t budget);
+
+// Stop the loader thread and delete the stored chunks
+void streamShutdown(void);
+
+// Move the window by dx, dy chunks. The world is woken and a new undo step
+// starts, which keeps the history in map positions so it can still be undone.
+// A window that initWorld resized since the last reset starts the store over
+// first. Returns false if the window would leave the map
+bool streamScroll(int dx, int dy);
+
+// Read the stored cells of map chunk (mx, my), CHUNK_SIZE rows of CHUNK_SIZE
+// cells from the bottom, or air if it isn't stored. Its cells inside the
+// window are as of when it was last stored, the world holds the current ones
+void streamReadChunk(int mx, int my, Block *cells);
+
+// Store the cells of map chunk (mx, my), laid out like for streamReadChunk.
+// For the cells outside the window, the world holds the ones inside it
+void streamWriteChunk(int mx, int my, const Block *cells);
+
+// Throw away every stored chunk and move the window back to the origin, for a
+// new game. Returns true if anything outside the window was thrown away
+bool streamReset(void);
@@ -1,15 +1,38 @@
 #include "ui.h"
 #include "block.h"
 #include "consts.h"
+#include "profile.h"
 #include "raylib.h"
+#include "sim.h"
 #include "state.h"
 #include "utils.h"
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 Font font;
 Font font_bold;
 
+screen_layout layout;
+
+void initLayout(int worldWidth, int worldHeight) {
+  float zoom = (float)MAX_WORLD_DISPLAY_SIZE / max(worldWidth, worldHeight);
+  zoom = fminf(zoom, PX_SCALE);
+
+  int worldPxWidth = (int)roundf(worldWidth * zoom);
+  int worldPxHeight = (int)roundf(worldHeight * zoom);
+
+  layout.fitZoom = zoom;
+  layout.screenWidth =
+      max(worldPxWidth + WORLD_DISPLAY_PADDING * 2, INTERFACE_WIDTH);
+  layout.screenHeight =
+      worldPxHeight + WORLD_DISPLAY_PADDING * 2 + INTERFACE_HEIGHT;
+  layout.worldTopLeftX = (layout.screenWidth - worldPxWidth) / 2;
+  layout.worldTopLeftY = WORLD_DISPLAY_PADDING;
+  layout.worldBottomRightX = (layout.screenWidth + worldPxWidth) / 2;
+  layout.worldBottomRightY = worldPxHeight + WORLD_DISPLAY_PADDING;
+}
+
 // Return false if the font fails to load.
 bool initFont() {
   font = LoadFontEx("resources/PixelifySans-Regular.ttf", 32, NULL, 250);
@@ -133,9 +156,94 @@ static void drawBlockPlaceWidth(game_state *state, int startX, int startY) {
   DrawTextEx(font, buf, (Vector2){startX, startY}, 20.0f, 0.0, RAYWHITE);
 }
 
+static void drawTool(game_state *state, int startX, int startY) {
+  static const char *TOOL_NAMES[TOOLS_COUNT] = {
+      [TOOL_BRUSH] = "Brush",
+      [TOOL_FILL] = "Fill",
+      [TOOL_REPLACE] = "Replace",
+  };
+  const char *text =
+      TextFormat("Tool: %s (T to switch)", TOOL_NAMES[state->tool]);
+  DrawTextEx(font, text, (Vector2){startX, startY}, 20.0f, 0.0, RAYWHITE);
+}
+
+static void drawMapPosition(game_state *state, int startX, int startY) {
+  const char *text = TextFormat("Map position: %d, %d (arrows to scroll)",
+                                state->originX, state->originY);
+  DrawTextEx(font, text, (Vector2){startX, startY}, 20.0f, 0.0, RAYWHITE);
+}
+
+// Short form of a count, like 950, 12.3k or 4.1M
+static const char *formatCount(uint64_t count) {
+  if (count < 1000) {
+    return TextFormat("%llu", (unsigned long long)count);
+  }
+  if (count < 1000000) {
+    return TextFormat("%.1fk", count / 1e3);
+  }
+  return TextFormat("%.1fM", count / 1e6);
+}
+
+static void drawMaterialCounts(int startX, int startY) {
+  const float FONT_SIZE = 20.0f;
+  const int SWATCH_SIZE = 14;
+  const int SPACING = 16;
+
+  const world_frame *frame = simLatestFrame();
+  int x = startX;
+  // Air fills the rest of the world, so it isn't worth showing
+  for (int type = AIR + 1; type < BLOCK_TYPES_COUNT; type++) {
+    DrawRectangle(x, startY + 3, SWATCH_SIZE, SWATCH_SIZE, BLOCKS[type].color);
+    x += SWATCH_SIZE + 5;
+    const char *text = TextFormat("%s %s", BLOCKS[type].displayName,
+                                  formatCount(frame->materialCounts[type]));
+    DrawTextEx(font, text, (Vector2){x, startY}, FONT_SIZE, 0.0, RAYWHITE);
+    x += MeasureTextEx(font, text, FONT_SIZE, 0.0).x + SPACING;
+  }
+}
+
 void drawInterface(game_state *state) {
-  int startX = WORLD_SCREEN_TOP_LEFT_X;
-  int startY = WORLD_SCREEN_BOTTOM_RIGHT_Y + WORLD_DISPLAY_PADDING;
+  int startX = layout.worldTopLeftX;
+  int startY = layout.worldBottomRightY + WORLD_DISPLAY_PADDING;
   Vector2 end = drawBlockPicker(state, startX, startY);
   drawBlockPlaceWidth(state, startX, end.y + 10);
+  drawTool(state, startX, end.y + 35);
+  drawMapPosition(state, startX, end.y + 60);
+  drawMaterialCounts(startX, end.y + 85);
+}
+
+#ifdef PROFILE
+void drawProfileOverlay() {
+  const float FONT_SIZE = 16.0f;
+  const int LINE_HEIGHT = 18;
+  const int PADDING = 6;
+  const int LINES = 1 + STAT_COUNT + TIMER_COUNT;
+
+  profile_sample sample;
+  profileRead(&sample);
+
+  int x = layout.worldTopLeftX;
+  int y = layout.worldTopLeftY;
+  DrawRectangle(x, y, 220, LINES * LINE_HEIGHT + PADDING * 2,
+                (Color){0, 0, 0, 180});
+  x += PADDING;
+  y += PADDING;
+
+  DrawTextEx(font, TextFormat("tick %llu", (unsigned long long)sample.tick),
+             (Vector2){x, y}, FONT_SIZE, 0.0, YELLOW);
+  for (int i = 0; i < STAT_COUNT; i++) {
+    y += LINE_HEIGHT;
+    DrawTextEx(font,
+               TextFormat("%s %llu", PROFILE_STAT_NAMES[i],
+                          (unsigned long long)sample.stats[i]),
+               (Vector2){x, y}, FONT_SIZE, 0.0, RAYWHITE);
+  }
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    y += LINE_HEIGHT;
+    DrawTextEx(font,
+               TextFormat("%s %.3f ms", PROFILE_TIMER_NAMES[i],
+                          sample.timerNs[i] / 1e6),
+               (Vector2){x, y}, FONT_SIZE, 0.0, RAYWHITE);
+  }
 }
+#endif
@@ -6,6 +6,27 @@
 extern Font font;
 extern Font font_bold;
 
+// Screen positions that depend on the world size, set by initLayout
+typedef struct {
+  // Screen pixels per cell that fit the whole world in the view
+  float fitZoom;
+  int screenWidth;
+  int screenHeight;
+  int worldTopLeftX;
+  int worldTopLeftY;
+  int worldBottomRightX;
+  int worldBottomRightY;
+} screen_layout;
+
+extern screen_layout layout;
+
+void initLayout(int worldWidth, int worldHeight);
+
 bool initFont();
 
 void drawInterface(game_state *state);
+
+#ifdef PROFILE
+// Draw the latest tick counters and timers over the top left of the world
+void drawProfileOverlay();
+#endif
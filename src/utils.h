@@ -1,6 +1,6 @@
 #pragma once
 
-#include "raylib.h"
+#include "color.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #define max(a, b) ((a) > (b) ? (a) : (b))
@@ -1,259 +1,1019 @@
 #include "world.h"
+#include "arena.h"
 #include "block.h"
+#include "census.h"
+#include "changes.h"
+#include "chunk.h"
 #include "consts.h"
+#include "planes.h"
+#include "pool.h"
+#include "profile.h"
 #include "rng.h"
 #include "state.h"
+#include "utils.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Ceiling divide a by b
+// https://stackoverflow.com/a/2745086
+#define CEIL_DIV(a, b) (1 + (((a) - 1) / (b)))
+
+#define UINT64_BITS (sizeof(uint64_t) * 8)
+
+// Backs the world cells and the per-tick scratch storage
+static arena worldArena;
+
+// Scratch list of the chunks to update in one phase of a parallel tick
+static int *phaseChunks;
+
+// Bitmasks of the chunks that may be awake: a word per 64 chunks of each chunk
+// row, and above them a bit per chunk row. A chunk's bits are set whenever its
+// dirty or nextDirty rect grows and only cleared when a tick starts, so the
+// chunks that sleep are skipped a word at a time and a whole row of them in a
+// single test
+static uint64_t *awakeChunks;
+static uint64_t *awakeRows;
+// Words of awakeChunks per chunk row
+static int awakeStride;
+
+// 0 runs the tick in a single pass over the whole world, anything else runs it
+// in checkerboard phases on that many threads
+static int tickThreads;
+
+// Set to update every cell with the plain serial scan, ignoring the chunk
+// rects and the planes
+static bool referenceTick;
+
+typedef enum { PASS_FALL, PASS_GAS, PASS_COUNT } tick_pass;
+
+// How many cells a cell falls in one tick at each velocity
+static const int FALL_DISTANCE[MAX_VELOCITY + 1] = {1, 2, 4, 8};
+
+enum { MAX_FALL_DISTANCE = 8 };
+
+// Upper bound for the dispersion of every fluid in BLOCKS
+enum { MAX_DISPERSION = 8 };
+
+// A falling cell reaches MAX_FALL_DISTANCE cells below itself, a fluid
+// MAX_DISPERSION cells to its side and the cells they wake are WAKE_MARGIN
+// further. Chunks updated at the same time in a parallel tick are a chunk
+// apart, so that has to stay within half a chunk
+typedef char fall_reach_check
+    [MAX_FALL_DISTANCE + WAKE_MARGIN <= CHUNK_SIZE / 2 ? 1 : -1];
+typedef char flow_reach_check
+    [MAX_DISPERSION + WAKE_MARGIN <= CHUNK_SIZE / 2 ? 1 : -1];
+
+// State for the cells updated in one tick, or in one chunk when the tick runs
+// in parallel
+typedef struct {
+  // Key of the counter-based random values for this tick, see cellRandom
+  uint64_t rngKey;
+  // Set when other threads update cells at the same time. Words and rects that
+  // are shared between chunks are then updated atomically
+  bool parallel;
+#ifdef PROFILE
+  // Counters for this tick, or for this chunk in a parallel tick
+  uint64_t *stats;
+#endif
+} tick_ctx;
+
+// Update of one cell in one pass, picked by the cell's material
+typedef void (*cell_kernel)(const tick_ctx *ctx, Block *block, int x, int y);
+
+// The update of every material in every pass, built from the properties in
+// BLOCKS so a cell only runs the checks that apply to its material
+static cell_kernel passKernels[PASS_COUNT][BLOCK_TYPES_COUNT];
+
+// How many cells each fluid can flow sideways in one tick, its dispersion from
+// BLOCKS clamped to 1..MAX_DISPERSION
+static int fluidDispersion[BLOCK_TYPES_COUNT];
+
+// Bitmask of the materials that can move in each pass. A chunk holding none of
+// them has nothing to update in the pass, see census.h
+static uint32_t passMovers[PASS_COUNT];
+
+static void initKernels(void);
+
+#ifdef PROFILE
+// Counters for the whole tick
+static uint64_t tickStats[STAT_COUNT];
+#endif
+
+bool initWorld(int width, int height) {
+  if (width < MIN_WORLD_SIZE || width > MAX_WORLD_SIZE ||
+      height < MIN_WORLD_SIZE || height > MAX_WORLD_SIZE) {
+    return false;
+  }
+
+  size_t cells = (size_t)width * height;
+  int chunksX = CEIL_DIV(width, CHUNK_SIZE);
+  int chunksY = CEIL_DIV(height, CHUNK_SIZE);
+  size_t worldBytes = cells * sizeof(Block);
+  size_t chunkBytes = (size_t)chunksX * chunksY * sizeof(chunk);
+  size_t phaseBytes = (size_t)chunksX * chunksY * sizeof(int);
+  int stride = CEIL_DIV(chunksX, UINT64_BITS);
+  size_t awakeBytes = (size_t)stride * chunksY * sizeof(uint64_t);
+  size_t rowBytes = CEIL_DIV(chunksY, UINT64_BITS) * sizeof(uint64_t);
+  size_t planeBytes = initPlanes(NULL, width, height);
+
+  // Everything is allocated before the old world is freed, so it is still there
+  // if any of it fails
+  arena next;
+  if (!arenaInit(&next, worldBytes + chunkBytes + phaseBytes + awakeBytes +
+                            rowBytes + planeBytes + ARENA_ALIGN * 5)) {
+    return false;
+  }
+  if (!changesInit(chunksX * chunksY) || !censusInit(chunksX * chunksY)) {
+    arenaFree(&next);
+    return false;
+  }
+  arenaFree(&worldArena);
+  worldArena = next;
+  _state.world = arenaAlloc(&worldArena, worldBytes, ARENA_ALIGN);
+  _state.chunks = arenaAlloc(&worldArena, chunkBytes, ARENA_ALIGN);
+  phaseChunks = arenaAlloc(&worldArena, phaseBytes, ARENA_ALIGN);
+  awakeChunks = arenaAlloc(&worldArena, awakeBytes, ARENA_ALIGN);
+  awakeRows = arenaAlloc(&worldArena, rowBytes, ARENA_ALIGN);
+  awakeStride = stride;
+  initPlanes(&worldArena, width, height);
+  initKernels();
+  _state.width = width;
+  _state.height = height;
+  _state.chunksX = chunksX;
+  _state.chunksY = chunksY;
+  // Nothing is listed as changed until the world is cleared below
+  for (int i = 0; i < chunksX * chunksY; i++) {
+    _state.chunks[i] = (chunk){
+        .dirty = EMPTY_RECT, .nextDirty = EMPTY_RECT, .changed = EMPTY_RECT};
+  }
+  memset(awakeChunks, 0, awakeBytes);
+  memset(awakeRows, 0, rowBytes);
+  clearWorld();
+  return true;
+}
+
+void clearWorld() {
+  size_t cells = (size_t)_state.width * _state.height;
+  for (size_t i = 0; i < cells; i++) {
+    _state.world[i] = AIR_BLOCK;
+  }
+  rebuildPlanes();
+  // Nothing can move in an empty world
+  sleepAllChunks();
+  changesMarkAll();
+}
+
+void refreshWorld() {
+  rebuildPlanes();
+  wakeArea(0, 0, _state.width - 1, _state.height - 1);
+}
 
 Block *getBlock(unsigned int x, unsigned int y) {
-  if (x >= WORLD_WIDTH || y >= WORLD_HEIGHT) {
+  if (x >= (unsigned int)_state.width || y >= (unsigned int)_state.height) {
     return NULL;
   }
-  return &_state.world[y][x];
+  return &_state.world[(size_t)y * _state.width + x];
 }
 
 bool setBlock(unsigned int x, unsigned int y, Block block) {
-  if (x >= WORLD_WIDTH || y >= WORLD_HEIGHT) {
+  Block *target = getBlock(x, y);
+  if (target == NULL) {
     return false;
   }
-  _state.world[y][x] = block;
+  setPlaneCell(x, y, target->type, block.type, false);
+  censusSetCell(x, y, target->type, block.type);
+  *target = block;
+  wakeArea(x, y, x, y);
   return true;
 }
 
+bool setTickThreads(int threads) {
+  if (threads < 0) {
+    return false;
+  }
+  if (threads > 0 && !poolInit(threads)) {
+    return false;
+  }
+  if (threads == 0) {
+    poolShutdown();
+  }
+  tickThreads = threads;
+  return true;
+}
+
+void setReferenceTick(bool enabled) { referenceTick = enabled; }
+
+uint64_t worldHash() {
+  // FNV-1a over the stored fields of every cell, so the unused bits of a block
+  // never change the hash
+  uint64_t hash = 14695981039346656037ULL;
+  size_t cells = (size_t)_state.width * _state.height;
+  for (size_t i = 0; i < cells; i++) {
+    const Block *b = &_state.world[i];
+    uint32_t fields = b->type | b->variant << 8 | b->movementDir << 11 |
+                      b->velocity << 13;
+    for (int byte = 0; byte < 2; byte++) {
+      hash ^= (fields >> (byte * 8)) & 0xff;
+      hash *= 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+static inline void atomicMin(int *target, int value) {
+  int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value < current &&
+         !__atomic_compare_exchange_n(target, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static inline void atomicMax(int *target, int value) {
+  int current = __atomic_load_n(target, __ATOMIC_RELAXED);
+  while (value > current &&
+         !__atomic_compare_exchange_n(target, &current, value, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+static inline void growRect(cell_rect *rect, const cell_rect *area,
+                            bool atomic) {
+  if (atomic) {
+    atomicMin(&rect->minX, area->minX);
+    atomicMin(&rect->minY, area->minY);
+    atomicMax(&rect->maxX, area->maxX);
+    atomicMax(&rect->maxY, area->maxY);
+    return;
+  }
+  rect->minX = min(rect->minX, area->minX);
+  rect->minY = min(rect->minY, area->minY);
+  rect->maxX = max(rect->maxX, area->maxX);
+  rect->maxY = max(rect->maxY, area->maxY);
+}
+
+static inline void setBit(uint64_t *bits, int index, bool atomic) {
+  uint64_t *word = &bits[index / UINT64_BITS];
+  uint64_t bit = 1ULL << (index % UINT64_BITS);
+  if (!atomic) {
+    *word |= bit;
+  } else if ((__atomic_load_n(word, __ATOMIC_RELAXED) & bit) == 0) {
+    __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+  }
+}
+
+// First set bit of the bitmask from bit from up to count - 1, or -1 if there
+// is none
+static int nextSetBit(const uint64_t *bits, int from, int count) {
+  while (from < count) {
+    int w = from / UINT64_BITS;
+    uint64_t word = bits[w] & ~0ULL << (from % UINT64_BITS);
+    if (word != 0) {
+      int index = w * UINT64_BITS + __builtin_ctzll(word);
+      return index < count ? index : -1;
+    }
+    from = (w + 1) * UINT64_BITS;
+  }
+  return -1;
+}
+
+// Last set bit of the bitmask from bit from down to 0, or -1 if there is none
+static int prevSetBit(const uint64_t *bits, int from) {
+  while (from >= 0) {
+    int w = from / UINT64_BITS;
+    uint64_t word = bits[w] & ~0ULL >> (UINT64_BITS - 1 - from % UINT64_BITS);
+    if (word != 0) {
+      return w * UINT64_BITS + UINT64_BITS - 1 - __builtin_clzll(word);
+    }
+    from = w * UINT64_BITS - 1;
+  }
+  return -1;
+}
+
+static inline uint64_t *awakeRow(int cy) {
+  return &awakeChunks[(size_t)cy * awakeStride];
+}
+
+static inline bool chunkRowAwake(int cy) {
+  return (awakeRows[cy / UINT64_BITS] >> (cy % UINT64_BITS)) & 1;
+}
+
+// Next chunk after the index in scan order that may be awake, or -1. Pass -1
+// for the first one
+static int nextAwakeChunk(int index) {
+  int start = index + 1;
+  int startY = start / _state.chunksX;
+  for (int cy = nextSetBit(awakeRows, startY, _state.chunksY); cy >= 0;
+       cy = nextSetBit(awakeRows, cy + 1, _state.chunksY)) {
+    int from = cy == startY ? start % _state.chunksX : 0;
+    int cx = nextSetBit(awakeRow(cy), from, _state.chunksX);
+    if (cx >= 0) {
+      return cy * _state.chunksX + cx;
+    }
+  }
+  return -1;
+}
+
+// Clear the bit of a chunk whose rects are both empty, and the bit of its row
+// once no chunk in it is left awake
+static void sleepChunk(int index) {
+  int cy = index / _state.chunksX;
+  int cx = index % _state.chunksX;
+  uint64_t *row = awakeRow(cy);
+  row[cx / UINT64_BITS] &= ~(1ULL << (cx % UINT64_BITS));
+  for (int w = 0; w < awakeStride; w++) {
+    if (row[w] != 0) {
+      return;
+    }
+  }
+  awakeRows[cy / UINT64_BITS] &= ~(1ULL << (cy % UINT64_BITS));
+}
+
+static void wakeAreaShared(int minX, int minY, int maxX, int maxY,
+                           bool atomic) {
+  minX = max(minX - WAKE_MARGIN, 0);
+  minY = max(minY - WAKE_MARGIN, 0);
+  maxX = min(maxX + WAKE_MARGIN, _state.width - 1);
+  maxY = min(maxY + WAKE_MARGIN, _state.height - 1);
+  if (minX > maxX || minY > maxY) {
+    return;
+  }
+
+  for (int cy = minY / CHUNK_SIZE; cy <= maxY / CHUNK_SIZE; cy++) {
+    int chunkMinY = max(minY, cy * CHUNK_SIZE);
+    int chunkMaxY = min(maxY, cy * CHUNK_SIZE + CHUNK_SIZE - 1);
+    setBit(awakeRows, cy, atomic);
+    for (int cx = minX / CHUNK_SIZE; cx <= maxX / CHUNK_SIZE; cx++) {
+      cell_rect area = {.minX = max(minX, cx * CHUNK_SIZE),
+                        .minY = chunkMinY,
+                        .maxX = min(maxX, cx * CHUNK_SIZE + CHUNK_SIZE - 1),
+                        .maxY = chunkMaxY};
+      chunk *c = &_state.chunks[cy * _state.chunksX + cx];
+      // Growing the current rect as well lets cells that have not been reached
+      // yet this tick react to the change straight away, the same as they
+      // would if every cell was updated
+      growRect(&c->dirty, &area, atomic);
+      growRect(&c->nextDirty, &area, atomic);
+      setBit(awakeRow(cy), cx, atomic);
+    }
+  }
+}
+
+void wakeArea(int minX, int minY, int maxX, int maxY) {
+  wakeAreaShared(minX, minY, maxX, maxY, false);
+
+  // Only the cells themselves changed, not the ones woken around them
+  minX = max(minX, 0);
+  minY = max(minY, 0);
+  maxX = min(maxX, _state.width - 1);
+  maxY = min(maxY, _state.height - 1);
+  if (minX > maxX || minY > maxY) {
+    return;
+  }
+  for (int cy = minY / CHUNK_SIZE; cy <= maxY / CHUNK_SIZE; cy++) {
+    for (int cx = minX / CHUNK_SIZE; cx <= maxX / CHUNK_SIZE; cx++) {
+      cell_rect area = {.minX = max(minX, cx * CHUNK_SIZE),
+                        .minY = max(minY, cy * CHUNK_SIZE),
+                        .maxX = min(maxX, cx * CHUNK_SIZE + CHUNK_SIZE - 1),
+                        .maxY = min(maxY, cy * CHUNK_SIZE + CHUNK_SIZE - 1)};
+      changesMark(cy * _state.chunksX + cx, &area);
+    }
+  }
+}
+
+bool worldAtRest() {
+  for (int i = nextAwakeChunk(-1); i >= 0; i = nextAwakeChunk(i)) {
+    const cell_rect *next = &_state.chunks[i].nextDirty;
+    if (next->minX <= next->maxX) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void sleepAllChunks() {
+  int count = _state.chunksX * _state.chunksY;
+  for (int i = 0; i < count; i++) {
+    _state.chunks[i].dirty = EMPTY_RECT;
+    _state.chunks[i].nextDirty = EMPTY_RECT;
+  }
+  memset(awakeChunks, 0,
+         (size_t)awakeStride * _state.chunksY * sizeof(uint64_t));
+  memset(awakeRows, 0,
+         CEIL_DIV(_state.chunksY, UINT64_BITS) * sizeof(uint64_t));
+}
+
+// Start a tick by moving the cells woken since the last tick into the current
+// rects, putting the chunks with none to sleep. The census is brought up to
+// date so the passes can tell which chunks hold cells that move
+static void beginChunkTick() {
+  for (int i = nextAwakeChunk(-1); i >= 0; i = nextAwakeChunk(i)) {
+    chunk *c = &_state.chunks[i];
+    c->dirty = c->nextDirty;
+    c->nextDirty = EMPTY_RECT;
+    if (c->dirty.minX > c->dirty.maxX) {
+      sleepChunk(i);
+    }
+  }
+  censusRefresh();
+}
+
 static inline void swap(Block *a, Block *b) {
   Block temp = *a;
   *a = *b;
   *b = temp;
 }
 
+// Stop the fall of the cell above the block when the block is one it
+// can't fall through. Cells that are no longer falling are not updated, so
+// their velocity has to be dropped when something moves under them
+static inline void landCellAbove(Block *block, int y) {
+  if (y + 1 < _state.height && !IsPassible(block)) {
+    Block *above = block + _state.width;
+    if (above->velocity != 0) {
+      above->velocity = 0;
+    }
+  }
+}
+
+// Swap two cells and wake the area around both of them. The updated flags
+// belong to the positions and stay where they are
+static inline void swapCells(const tick_ctx *ctx, Block *a, int ax, int ay,
+                             Block *b, int bx, int by) {
+  if (a->type != b->type) {
+    setPlaneCell(ax, ay, a->type, b->type, ctx->parallel);
+    setPlaneCell(bx, by, b->type, a->type, ctx->parallel);
+    censusSwap(ax, ay, bx, by, a->type, b->type, ctx->parallel);
+  }
+  bool aUpdated = a->updated;
+  bool bUpdated = b->updated;
+  swap(a, b);
+  a->updated = aUpdated;
+  b->updated = bUpdated;
+  landCellAbove(a, ay);
+  landCellAbove(b, by);
+  wakeAreaShared(min(ax, bx), min(ay, by), max(ax, bx), max(ay, by),
+                 ctx->parallel);
+}
+
 static inline bool isPassibleBlock(Block *block) {
   return block != NULL && IsPassible(block);
 }
 
-// Ceiling divide a by b
-// https://stackoverflow.com/a/2745086
-#define CEIL_DIV(a, b) (1 + (((a) - 1) / (b)))
-
-#define UINT64_BITS (sizeof(uint64_t) * 8)
+// Mark whether the cell at the position already moved this tick. The flag is
+// kept in the cell itself so checking it touches the same cache line as the
+// cell. Only the thread updating a chunk touches the cells around it, so
+// unlike shared bitmap words the flags never need atomics
+static inline void setCellProcessed(const tick_ctx *ctx, int x, int y,
+                                    bool value) {
+  (void)ctx;
+  _state.world[(size_t)y * _state.width + x].updated = value;
+}
 
-enum {
-  // Calculate the size of the bitmap
-  BITMAP_SIZE = CEIL_DIV(WORLD_WIDTH * WORLD_HEIGHT, UINT64_BITS),
-};
-
-bool hasCellProcessed(uint64_t processed[BITMAP_SIZE], unsigned int x,
-                      unsigned int y) {
-  unsigned int a = y * WORLD_WIDTH + x;
-  unsigned int idx = a / UINT64_BITS;
-  unsigned int rem = a % UINT64_BITS;
-  uint64_t val = (processed[idx] >> rem) & 0x1;
-  return val == 1;
-}
-
-void setCellProcessed(uint64_t processed[BITMAP_SIZE], unsigned int x,
-                      unsigned int y, bool value) {
-  unsigned int a = y * WORLD_WIDTH + x;
-  unsigned int idx = a / UINT64_BITS;
-  unsigned int rem = a % UINT64_BITS;
-  // Cast value to 64-bit before shifting to avoid undefined behavior when
-  // rem >= 32 on platforms where int is 32 bits.
-  processed[idx] = (processed[idx] & ~(1ULL << rem)) | ((uint64_t)value << rem);
-}
-
-static bool trySwapWithCandidates(Block *block, int x, int y, Block *first,
-                                  bool firstPassible, int firstDx, int firstDy,
-                                  Block *second, bool secondPassible,
-                                  int secondDx, int secondDy,
-                                  uint64_t processed[BITMAP_SIZE],
-                                  bool markBelow) {
+static bool trySwapWithCandidates(const tick_ctx *ctx, Block *block, int x,
+                                  int y, Block *first, bool firstPassible,
+                                  int firstDx, int firstDy, Block *second,
+                                  bool secondPassible, int secondDx,
+                                  int secondDy, bool markBelow) {
   if (!firstPassible && !secondPassible) {
     return false;
   }
 
   bool useFirst =
-      firstPassible && secondPassible ? pcg32_bool() : firstPassible;
+      firstPassible && secondPassible
+          ? cellRandomBool(ctx->rngKey, x, y, RNG_STREAM_PICK_SIDE)
+          : firstPassible;
   Block *target = useFirst ? first : second;
   int destX = x + (useFirst ? firstDx : secondDx);
   int destY = y + (useFirst ? firstDy : secondDy);
 
-  swap(target, block);
-  setCellProcessed(processed, destX, destY, true);
+  swapCells(ctx, target, destX, destY, block, x, y);
+  setCellProcessed(ctx, destX, destY, true);
   if (markBelow) {
-    setCellProcessed(processed, x, y - 1, true);
+    setCellProcessed(ctx, x, y - 1, true);
   }
-  setCellProcessed(processed, x, y, true);
+  setCellProcessed(ctx, x, y, true);
   return true;
 }
 
-void worldTick() {
+// Fall straight down if the cell below is passible. The cell falls as far as
+// its velocity allows through the cells of the same type as the one below it
+// in a single swap, which leaves the same cells behind as falling one cell at
+// a time would
+static bool tryFall(const tick_ctx *ctx, Block *block, int x, int y) {
+  Block *below = getBlock(x, y - 1);
+  if (!IsPassible(below)) {
+    return false;
+  }
 
-  // Bitmap
-  uint64_t processed[BITMAP_SIZE] = {false};
+  int distance = FALL_DISTANCE[block->velocity];
+  int fall = 1;
+  const Block *next = below - _state.width;
+  while (fall < distance && y - fall - 1 >= 0 && next->type == below->type) {
+    fall++;
+    next -= _state.width;
+  }
 
-  // Handle blocks that fall down
-  for (int y = 0; y < WORLD_HEIGHT; y++) {
-    for (int x = 0; x < WORLD_WIDTH; x++) {
-      if (hasCellProcessed(processed, x, y)) {
-        continue;
-      }
+  // Keep speeding up until the cell lands
+  int destY = y - fall;
+  int velocity = block->velocity;
+  if (!IsPassible(getBlock(x, destY - 1))) {
+    velocity = 0;
+  } else if (velocity < MAX_VELOCITY) {
+    velocity++;
+  }
 
-      Block *block = getBlock(x, y);
-      Block *below = getBlock(x, y - 1);
+  PROFILE_COUNT(ctx->stats, STAT_FALLS);
+  Block *target = getBlock(x, destY);
+  swapCells(ctx, block, x, y, target, x, destY);
+  target->velocity = velocity;
+  setCellProcessed(ctx, x, destY, true);
+  setCellProcessed(ctx, x, y, true);
+  return true;
+}
 
-      // Skip gases because they are handled later
-      if (IsGas(block)) {
-        continue;
-      }
+// Sink through the fluid below a solid cell. Always moves the cell when the
+// cell below is a fluid
+static bool trySink(const tick_ctx *ctx, Block *block, int x, int y) {
+  Block *below = getBlock(x, y - 1);
+  if (!IsFluid(below)) {
+    return false;
+  }
 
-      if (y > 0 && HasGravity(block)) {
-        // Try falling straight down first
-        if (IsPassible(below)) {
-          swap(block, below);
-          setCellProcessed(processed, x, y - 1, true);
-          setCellProcessed(processed, x, y, true);
-          continue;
-        }
+  // Check which blocks are passible
+  // Order: above -> side -> lower diagonal -> upper diagonal -> swap
+  // (last resort)
+  // TODO: Find a better last resort method because this might teleport
+  // blocks up too far
+
+  Block *above = getBlock(x, y + 1);
+  if (isPassibleBlock(above)) {
+    swapCells(ctx, block, x, y, below, x, y - 1);
+    setCellProcessed(ctx, x, y, true);
+    setCellProcessed(ctx, x, y - 1, true);
+  }
 
-        // Check to see if the block below is water
-        if (!IsFluid(block) && IsFluid(below)) {
-          // Check which blocks are passible
-          // Order: above -> side -> lower diagonal -> upper diagonal -> swap
-          // (last resort)
-          // TODO: Find a better last resort method because this might teleport
-          // blocks up too far
-
-          Block *above = getBlock(x, y + 1);
-          if (isPassibleBlock(above)) {
-            swap(block, below);
-            setCellProcessed(processed, x, y, true);
-            setCellProcessed(processed, x, y - 1, true);
-          }
-
-          Block *leftBlock = getBlock(x - 1, y - 1);
-          Block *rightBlock = getBlock(x + 1, y - 1);
-          if (trySwapWithCandidates(block, x, y, leftBlock,
-                                    isPassibleBlock(leftBlock), -1, -1,
-                                    rightBlock, isPassibleBlock(rightBlock), 1,
-                                    -1, processed, true)) {
-            continue;
-          }
-
-          leftBlock = getBlock(x - 1, y - 2);
-          rightBlock = getBlock(x + 1, y - 2);
-          if (trySwapWithCandidates(block, x, y, leftBlock,
-                                    isPassibleBlock(leftBlock), -1, -2,
-                                    rightBlock, isPassibleBlock(rightBlock), 1,
-                                    -2, processed, true)) {
-            continue;
-          }
-
-          leftBlock = getBlock(x - 1, y);
-          rightBlock = getBlock(x + 1, y);
-          if (trySwapWithCandidates(block, x, y, leftBlock,
-                                    isPassibleBlock(leftBlock), -1, 0,
-                                    rightBlock, isPassibleBlock(rightBlock), 1,
-                                    0, processed, true)) {
-            continue;
-          }
-
-          // Last resort swap
-          swap(below, block);
-          setCellProcessed(processed, x, y - 1, true);
-          setCellProcessed(processed, x, y, true);
-          continue;
-        }
-      }
+  Block *leftBlock = getBlock(x - 1, y - 1);
+  Block *rightBlock = getBlock(x + 1, y - 1);
+  if (trySwapWithCandidates(ctx, block, x, y, leftBlock,
+                            isPassibleBlock(leftBlock), -1, -1, rightBlock,
+                            isPassibleBlock(rightBlock), 1, -1, true)) {
+    return true;
+  }
 
-      // If can't fall straight, try sliding diagonally
-      if (CanSlide(block)) {
-        Block *leftBlock = getBlock(x - 1, y - 1);
-        bool isLeftPassible =
-            (IsPassible(leftBlock) || IsFluid(leftBlock)) &&
-            (IsPassible(getBlock(x - 1, y)) || IsFluid(getBlock(x - 1, y))) &&
-            leftBlock->type != block->type;
-        Block *rightBlock = getBlock(x + 1, y - 1);
-        bool isRightPassible =
-            (IsPassible(rightBlock) || IsFluid(rightBlock)) &&
-            (IsPassible(getBlock(x + 1, y)) || IsFluid(getBlock(x + 1, y))) &&
-            rightBlock->type != block->type;
-        if (trySwapWithCandidates(block, x, y, leftBlock, isLeftPassible, -1,
-                                  -1, rightBlock, isRightPassible, 1, -1,
-                                  processed, false)) {
-          continue;
-        }
-      }
+  leftBlock = getBlock(x - 1, y - 2);
+  rightBlock = getBlock(x + 1, y - 2);
+  if (trySwapWithCandidates(ctx, block, x, y, leftBlock,
+                            isPassibleBlock(leftBlock), -1, -2, rightBlock,
+                            isPassibleBlock(rightBlock), 1, -2, true)) {
+    return true;
+  }
 
-      // Move fluids side to side
-      // TODO: Fix weird fluid movement logic where going one direction it will
-      // clump together but the other it will break apart
-      if (IsFluid(block)) {
-        Block *leftBlock = getBlock(x - 1, y);
-        bool isLeftPassible = IsPassible(leftBlock);
-
-        Block *rightBlock = getBlock(x + 1, y);
-        bool isRightPassible = IsPassible(rightBlock);
-        // Make sure there is a place to move before doing other checks
-        if (isLeftPassible || isRightPassible) {
-
-          if (isLeftPassible && !isRightPassible) {
-            // Only the left is passible
-            block->movementDir = DIR_LEFT;
-          } else if (!isLeftPassible && isRightPassible) {
-            // Only the right is passible
-            block->movementDir = DIR_RIGHT;
-          } else if (block->movementDir == DIR_NONE) {
-            // Randomly generate a new fluid direction
-            block->movementDir = pcg32_bool() ? DIR_LEFT : DIR_RIGHT;
-          }
-
-          if (block->movementDir == DIR_LEFT) {
-            Direction leftDir = leftBlock->movementDir;
-            Direction currentDir = block->movementDir;
-            swap(leftBlock, block);
-            block->movementDir = leftDir;
-            leftBlock->movementDir = currentDir;
-            setCellProcessed(processed, x - 1, y, true);
-            setCellProcessed(processed, x, y, true);
-            continue;
-          } else if (block->movementDir == DIR_RIGHT) {
-            Direction rightDir = rightBlock->movementDir;
-            Direction currentDir = block->movementDir;
-            swap(rightBlock, block);
-            block->movementDir = rightDir;
-            rightBlock->movementDir = currentDir;
-            setCellProcessed(processed, x + 1, y, true);
-            setCellProcessed(processed, x, y, true);
-            continue;
-          }
-        } else {
-          block->movementDir = DIR_NONE;
-        }
+  leftBlock = getBlock(x - 1, y);
+  rightBlock = getBlock(x + 1, y);
+  if (trySwapWithCandidates(ctx, block, x, y, leftBlock,
+                            isPassibleBlock(leftBlock), -1, 0, rightBlock,
+                            isPassibleBlock(rightBlock), 1, 0, true)) {
+    return true;
+  }
+
+  // Last resort swap
+  PROFILE_COUNT(ctx->stats, STAT_LAST_RESORT);
+  swapCells(ctx, below, x, y - 1, block, x, y);
+  setCellProcessed(ctx, x, y - 1, true);
+  setCellProcessed(ctx, x, y, true);
+  return true;
+}
+
+// Slide down diagonally when the cell can't fall straight
+static bool trySlide(const tick_ctx *ctx, Block *block, int x, int y) {
+  Block *leftBlock = getBlock(x - 1, y - 1);
+  bool isLeftPassible =
+      (IsPassible(leftBlock) || IsFluid(leftBlock)) &&
+      (IsPassible(getBlock(x - 1, y)) || IsFluid(getBlock(x - 1, y))) &&
+      leftBlock->type != block->type;
+  Block *rightBlock = getBlock(x + 1, y - 1);
+  bool isRightPassible =
+      (IsPassible(rightBlock) || IsFluid(rightBlock)) &&
+      (IsPassible(getBlock(x + 1, y)) || IsFluid(getBlock(x + 1, y))) &&
+      rightBlock->type != block->type;
+  if (trySwapWithCandidates(ctx, block, x, y, leftBlock, isLeftPassible, -1,
+                            -1, rightBlock, isRightPassible, 1, -1, false)) {
+    PROFILE_COUNT(ctx->stats, STAT_SLIDES);
+    return true;
+  }
+  return false;
+}
+
+// Flow sideways in the fluid's direction, picking a new one when that way is
+// blocked. The fluid jumps in a single swap to the farthest cell it can reach
+// within its dispersion, moving through cells of the same type as the one
+// next to it. It stops early over a passible cell so it drops into holes
+// instead of flowing past them
+static void spreadFluid(const tick_ctx *ctx, Block *block, int x, int y) {
+  Block *leftBlock = getBlock(x - 1, y);
+  bool isLeftPassible = IsPassible(leftBlock);
+
+  Block *rightBlock = getBlock(x + 1, y);
+  bool isRightPassible = IsPassible(rightBlock);
+  // Make sure there is a place to move before doing other checks
+  if (!isLeftPassible && !isRightPassible) {
+    block->movementDir = DIR_NONE;
+    return;
+  }
+
+  if (isLeftPassible && !isRightPassible) {
+    // Only the left is passible
+    block->movementDir = DIR_LEFT;
+  } else if (!isLeftPassible && isRightPassible) {
+    // Only the right is passible
+    block->movementDir = DIR_RIGHT;
+  } else if (block->movementDir == DIR_NONE) {
+    // Randomly generate a new fluid direction
+    block->movementDir =
+        cellRandomBool(ctx->rngKey, x, y, RNG_STREAM_FLUID_DIR) ? DIR_LEFT
+                                                                : DIR_RIGHT;
+  }
+
+  int dx = block->movementDir == DIR_LEFT ? -1 : 1;
+  const Block *first = dx < 0 ? leftBlock : rightBlock;
+  int distance = fluidDispersion[block->type];
+  int flow = 1;
+  while (flow < distance && !IsPassible(getBlock(x + dx * flow, y - 1))) {
+    const Block *next = getBlock(x + dx * (flow + 1), y);
+    if (next == NULL || next->type != first->type) {
+      break;
+    }
+    flow++;
+  }
+
+  PROFILE_COUNT(ctx->stats, STAT_FLUID_MOVES);
+  int destX = x + dx * flow;
+  Block *target = getBlock(destX, y);
+  swapCells(ctx, target, destX, y, block, x, y);
+  setCellProcessed(ctx, destX, y, true);
+  setCellProcessed(ctx, x, y, true);
+}
+
+// Materials that never move on their own, like rock and air. Gases use it in
+// the fall pass because they only move in the gas pass
+static void updateStatic(const tick_ctx *ctx, Block *block, int x, int y) {
+  (void)ctx;
+  (void)block;
+  (void)x;
+  (void)y;
+}
+
+// Solids that fall, sink through fluids and slide into piles, like sand
+static void updatePowder(const tick_ctx *ctx, Block *block, int x, int y) {
+  if (tryFall(ctx, block, x, y) || trySink(ctx, block, x, y)) {
+    return;
+  }
+  trySlide(ctx, block, x, y);
+}
+
+// Fluids that fall, slide and then spread sideways, like water
+static void updateLiquid(const tick_ctx *ctx, Block *block, int x, int y) {
+  if (tryFall(ctx, block, x, y) || trySlide(ctx, block, x, y)) {
+    return;
+  }
+  spreadFluid(ctx, block, x, y);
+}
+
+// Gases rise into passible cells of a different type above them
+static void updateGas(const tick_ctx *ctx, Block *block, int x, int y) {
+  Block *above = getBlock(x, y + 1);
+  if (IsPassible(above) && block->type != above->type) {
+    PROFILE_COUNT(ctx->stats, STAT_GAS_RISES);
+    swapCells(ctx, block, x, y, above, x, y + 1);
+    setCellProcessed(ctx, x, y + 1, true);
+    setCellProcessed(ctx, x, y, true);
+  }
+}
+
+// Any other mix of properties in the fall pass, checking each of them
+static void updateGeneric(const tick_ctx *ctx, Block *block, int x, int y) {
+  if (HasGravity(block)) {
+    if (tryFall(ctx, block, x, y) ||
+        (!IsFluid(block) && trySink(ctx, block, x, y))) {
+      return;
+    }
+  }
+  if (CanSlide(block) && trySlide(ctx, block, x, y)) {
+    return;
+  }
+  if (IsFluid(block)) {
+    spreadFluid(ctx, block, x, y);
+  }
+}
+
+// Pick the update of a material in a pass from its properties
+static cell_kernel kernelForType(tick_pass pass, int type) {
+  uint64_t props = BLOCKS[type].props;
+  bool gas = HAS_PROPERTY(props, IS_GAS);
+  if (pass == PASS_GAS || gas) {
+    return pass == PASS_GAS && gas ? updateGas : updateStatic;
+  }
+
+  bool gravity = HAS_PROPERTY(props, HAS_GRAVITY);
+  bool slide = HAS_PROPERTY(props, CAN_SLIDE);
+  bool fluid = HAS_PROPERTY(props, IS_FLUID);
+  if (!gravity && !slide && !fluid) {
+    return updateStatic;
+  }
+  if (gravity && slide) {
+    return fluid ? updateLiquid : updatePowder;
+  }
+  return updateGeneric;
+}
+
+static void initKernels(void) {
+  for (int pass = 0; pass < PASS_COUNT; pass++) {
+    passMovers[pass] = 0;
+    for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+      passKernels[pass][type] = kernelForType(pass, type);
+      if (passKernels[pass][type] != updateStatic) {
+        passMovers[pass] |= 1u << type;
       }
     }
   }
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    fluidDispersion[type] =
+        max(1, min(BLOCKS[type].dispersion, MAX_DISPERSION));
+  }
+}
+
+// Update a single cell in the pass with its material's update
+static inline void updateCell(const tick_ctx *ctx, tick_pass pass, int x,
+                              int y) {
+  Block *block = &_state.world[(size_t)y * _state.width + x];
+  if (block->updated) {
+    PROFILE_COUNT(ctx->stats, STAT_SKIPPED);
+    return;
+  }
+  PROFILE_COUNT(ctx->stats, STAT_VISITED);
+  passKernels[pass][block->type](ctx, block, x, y);
+}
+
+// First cell of row y from x up to maxX that might move in the pass, or
+// maxX + 1 if there is none
+static int nextCandidate(const tick_ctx *ctx, tick_pass pass, int y, int x,
+                         int maxX) {
+  while (x <= maxX) {
+    int w = x / UINT64_BITS;
+    uint64_t bits = pass == PASS_FALL ? fallCandidates(y, w, ctx->parallel)
+                                      : gasCandidates(y, w, ctx->parallel);
+    bits &= ~0ULL << (x % UINT64_BITS);
+    if (bits != 0) {
+      return w * UINT64_BITS + __builtin_ctzll(bits);
+    }
+    x = (w + 1) * UINT64_BITS;
+  }
+  return maxX + 1;
+}
+
+// Last cell of row y from x down to minX that might move in the pass, or
+// minX - 1 if there is none
+static int prevCandidate(const tick_ctx *ctx, tick_pass pass, int y, int x,
+                         int minX) {
+  while (x >= minX) {
+    int w = x / UINT64_BITS;
+    uint64_t bits = pass == PASS_FALL ? fallCandidates(y, w, ctx->parallel)
+                                      : gasCandidates(y, w, ctx->parallel);
+    bits &= ~0ULL >> (UINT64_BITS - 1 - x % UINT64_BITS);
+    if (bits != 0) {
+      return w * UINT64_BITS + UINT64_BITS - 1 - __builtin_clzll(bits);
+    }
+    x = w * UINT64_BITS - 1;
+  }
+  return minX - 1;
+}
+
+// Whether row y is scanned from right to left this tick. Alternating the
+// direction by row and tick keeps cells that move sideways from drifting
+// further one way than the other
+static inline bool scanLeftward(int y) {
+  return ((uint64_t)y + _state.tick) & 1;
+}
+
+// Update the cells of row y inside the rect that might move in the pass. The
+// candidates are recomputed after every update and the rect is reread, because
+// updating a cell changes its neighbours and can wake more of the chunk
+static void updateRow(const tick_ctx *ctx, tick_pass pass, int y,
+                      const cell_rect *dirty) {
+  if (scanLeftward(y)) {
+    for (int x = prevCandidate(ctx, pass, y, dirty->maxX, dirty->minX);
+         x >= dirty->minX;
+         x = prevCandidate(ctx, pass, y, x - 1, dirty->minX)) {
+      updateCell(ctx, pass, x, y);
+    }
+    return;
+  }
+  for (int x = nextCandidate(ctx, pass, y, dirty->minX, dirty->maxX);
+       x <= dirty->maxX; x = nextCandidate(ctx, pass, y, x + 1, dirty->maxX)) {
+    updateCell(ctx, pass, x, y);
+  }
+}
+
+// Update row y of the chunk in the pass, unless the row is outside of its rect
+// or the chunk holds nothing that moves in the pass. Cells that move into the
+// chunk during the pass are marked as updated, so a chunk that holds nothing
+// to move when it is reached has nothing to update for the rest of the pass
+static void updateChunkRow(const tick_ctx *ctx, tick_pass pass, int y,
+                           int index) {
+  const cell_rect *dirty = &_state.chunks[index].dirty;
+  if (y < dirty->minY || y > dirty->maxY ||
+      !censusChunkHolds(index, passMovers[pass])) {
+    return;
+  }
+  updateRow(ctx, pass, y, dirty);
+}
+
+// Update row y of every awake chunk in the pass, in the row's scan direction.
+// The bits are reread after every chunk since updating one can wake the next
+static void updateChunkRows(const tick_ctx *ctx, tick_pass pass, int y) {
+  int cy = y / CHUNK_SIZE;
+  if (!chunkRowAwake(cy)) {
+    return;
+  }
+  const uint64_t *awake = awakeRow(cy);
+  int rowStart = cy * _state.chunksX;
+  if (scanLeftward(y)) {
+    for (int cx = prevSetBit(awake, _state.chunksX - 1); cx >= 0;
+         cx = prevSetBit(awake, cx - 1)) {
+      updateChunkRow(ctx, pass, y, rowStart + cx);
+    }
+    return;
+  }
+  for (int cx = nextSetBit(awake, 0, _state.chunksX); cx >= 0;
+       cx = nextSetBit(awake, cx + 1, _state.chunksX)) {
+    updateChunkRow(ctx, pass, y, rowStart + cx);
+  }
+}
+
+// Update every cell of the world in scan order. This is the tick as it was
+// before chunks and planes were added, kept to check the faster paths against
+static void worldTickReference(uint64_t rngKey) {
+  tick_ctx ctx = {.rngKey = rngKey, .parallel = false};
+#ifdef PROFILE
+  ctx.stats = tickStats;
+#endif
+
+  for (int y = 0; y < _state.height; y++) {
+    bool leftward = scanLeftward(y);
+    for (int i = 0; i < _state.width; i++) {
+      updateCell(&ctx, PASS_FALL, leftward ? _state.width - 1 - i : i, y);
+    }
+  }
+  for (int y = _state.height - 1; y >= 0; y--) {
+    bool leftward = scanLeftward(y);
+    for (int i = 0; i < _state.width; i++) {
+      updateCell(&ctx, PASS_GAS, leftward ? _state.width - 1 - i : i, y);
+    }
+  }
+}
+
+static void worldTickSerial(uint64_t rngKey) {
+  tick_ctx ctx = {.rngKey = rngKey, .parallel = false};
+#ifdef PROFILE
+  ctx.stats = tickStats;
+#endif
+
+  // Handle blocks that fall down
+  for (int y = 0; y < _state.height; y++) {
+    updateChunkRows(&ctx, PASS_FALL, y);
+  }
 
   // Handle blocks that float upward
   // TODO: Allow smoke to move diagonally
-  for (int y = WORLD_HEIGHT - 1; y >= 0; y--) {
-    for (int x = 0; x < WORLD_WIDTH; x++) {
-      if (hasCellProcessed(processed, x, y)) {
-        continue;
-      }
+  for (int y = _state.height - 1; y >= 0; y--) {
+    updateChunkRows(&ctx, PASS_GAS, y);
+  }
+}
 
-      Block *block = getBlock(x, y);
-      Block *above = getBlock(x, y + 1);
+typedef struct {
+  tick_pass pass;
+  uint64_t rngKey;
+} phase_job;
+
+// Update the awake cells of one chunk, in the same order the serial tick would
+// visit them
+static void updateChunkJob(void *arg, int job) {
+  const phase_job *phase = arg;
+  int index = phaseChunks[job];
+  cell_rect *dirty = &_state.chunks[index].dirty;
+  tick_ctx ctx = {.rngKey = phase->rngKey, .parallel = true};
+  if (!censusChunkHolds(index, passMovers[phase->pass])) {
+    return;
+  }
+#ifdef PROFILE
+  uint64_t stats[STAT_COUNT] = {0};
+  ctx.stats = stats;
+#endif
+
+  if (phase->pass == PASS_FALL) {
+    for (int y = dirty->minY; y <= dirty->maxY; y++) {
+      updateRow(&ctx, PASS_FALL, y, dirty);
+    }
+  } else {
+    for (int y = dirty->maxY; y >= dirty->minY; y--) {
+      updateRow(&ctx, PASS_GAS, y, dirty);
+    }
+  }
+
+#ifdef PROFILE
+  for (int i = 0; i < STAT_COUNT; i++) {
+    __atomic_fetch_add(&tickStats[i], stats[i], __ATOMIC_RELAXED);
+  }
+#endif
+}
 
-      // Skip non gases since they were handled earlier
-      if (!IsGas(block)) {
-        continue;
+// Update the world chunk by chunk on the worker pool.
+//
+// A cell never reaches more than MAX_FALL_DISTANCE + WAKE_MARGIN cells below
+// its own chunk or MAX_DISPERSION + WAKE_MARGIN cells to its side, which
+// fall_reach_check and flow_reach_check keep within half a chunk, so chunks
+// that are two chunks apart never touch the same cells. Every pass is split
+// into four phases by the parity of the chunk coordinates and the chunks of
+// one phase run concurrently.
+static void worldTickParallel(uint64_t rngKey) {
+  phase_job job = {.rngKey = rngKey};
+
+  for (int pass = PASS_FALL; pass < PASS_COUNT; pass++) {
+    job.pass = pass;
+    for (int phase = 0; phase < 4; phase++) {
+      // Chunks can be woken by the previous phase, so the list is built just
+      // before the phase runs
+      int jobs = 0;
+      for (int i = nextAwakeChunk(-1); i >= 0; i = nextAwakeChunk(i)) {
+        int cx = i % _state.chunksX;
+        int cy = i / _state.chunksX;
+        cell_rect *dirty = &_state.chunks[i].dirty;
+        if ((cy & 1) == phase >> 1 && (cx & 1) == (phase & 1) &&
+            dirty->minX <= dirty->maxX) {
+          phaseChunks[jobs++] = i;
+        }
       }
+      poolRun(updateChunkJob, &job, jobs);
+    }
+  }
+}
 
-      if (IsGas(block) && IsPassible(above) && block->type != above->type) {
-        swap(block, above);
-        setCellProcessed(processed, x, y + 1, true);
-        setCellProcessed(processed, x, y, true);
+// Clear the updated flags set during the tick. A flag is only set next to a
+// cell that moved, which wakes the area around it, so every flag set lies
+// inside a rect to update next tick and only those rects need clearing
+static void clearUpdatedCells() {
+  for (int i = nextAwakeChunk(-1); i >= 0; i = nextAwakeChunk(i)) {
+    const cell_rect *rect = &_state.chunks[i].nextDirty;
+    for (int y = rect->minY; y <= rect->maxY; y++) {
+      Block *row = &_state.world[(size_t)y * _state.width];
+      for (int x = rect->minX; x <= rect->maxX; x++) {
+        row[x].updated = 0;
       }
     }
   }
 }
+
+// Add the cells the tick updated and the ones it woke, which hold every cell
+// it wrote, to the changed cells of each chunk
+static void markTickChanges() {
+  for (int i = nextAwakeChunk(-1); i >= 0; i = nextAwakeChunk(i)) {
+    const chunk *c = &_state.chunks[i];
+    if (c->dirty.minX <= c->dirty.maxX) {
+      changesMark(i, &c->dirty);
+    }
+    if (c->nextDirty.minX <= c->nextDirty.maxX) {
+      changesMark(i, &c->nextDirty);
+    }
+  }
+}
+
+void worldTick() {
+  PROFILE_BEGIN(TIMER_TICK);
+#ifdef PROFILE
+  memset(tickStats, 0, sizeof(tickStats));
+#endif
+
+  // The cells changed since the last tick are the ones to update now
+  beginChunkTick();
+
+  // Random values only depend on the seed, tick and cell, never on the order
+  // cells are visited in or which thread visits them
+  uint64_t rngKey = tickRandomKey(_state.seed, _state.tick);
+  if (referenceTick) {
+    worldTickReference(rngKey);
+  } else if (tickThreads > 0) {
+    worldTickParallel(rngKey);
+  } else {
+    worldTickSerial(rngKey);
+  }
+  clearUpdatedCells();
+  markTickChanges();
+  _state.tick++;
+  changesCollect();
+
+  PROFILE_END(TIMER_TICK);
+#ifdef PROFILE
+  profileEndTick(_state.tick, tickStats);
+#endif
+}
@@ -1,9 +1,45 @@
 #pragma once
 
 #include "block.h"
+#include <stdint.h>
+
+// Allocate the world storage. Must be called once before anything else uses
+// the world. Returns false if the size is out of range or allocation fails, in
+// which case the world from before is left as it was
+bool initWorld(int width, int height);
 
 Block *getBlock(unsigned int x, unsigned int y);
 
 bool setBlock(unsigned int x, unsigned int y, Block block);
 
+// Mark the cells in the rectangle as changed so they and their neighbours are
+// updated on the next tick. Coordinates outside of the world are clipped
+void wakeArea(int minX, int minY, int maxX, int maxY);
+
+void sleepAllChunks();
+
+// Whether nothing is left to update on the next tick, so the world won't
+// change again until something outside of the tick changes it
+bool worldAtRest();
+
+// Fill the world with air
+void clearWorld();
+
+// Recompute everything derived from the cells and wake the whole world. Call
+// after writing to _state.world directly instead of through setBlock
+void refreshWorld();
+
+// Choose how the tick runs. 0 updates the whole world in a single pass, any
+// other count updates it in checkerboard chunk phases on that many threads.
+// The result for a fixed seed is the same for every count above 0
+bool setTickThreads(int threads);
+
+// Update every cell on every tick with the plain serial scan instead of the
+// configured tick. Much slower, but gives the same result as the serial tick
+// and is useful to find where the optimized paths diverge
+void setReferenceTick(bool enabled);
+
+// 64-bit hash of every cell in the world, for comparing runs
+uint64_t worldHash();
+
 void worldTick();
@@ -0,0 +1,319 @@
+// Headless tick benchmark. Runs fixed scenarios through the simulation core
+// with a fixed seed and reports the tick throughput.
+//
+// Usage: bench [ticks] [seed] [WIDTHxHEIGHT] [threads]
+//
+// With a thread count every scenario is run with the serial tick and then with
+// the parallel tick on 1, 2, 4, ... up to that many threads to show how the
+// throughput scales.
+//
+// Scenarios that come to rest are then run again until nothing is left to
+// update to report how many ticks that takes.
+//
+// The tick only ever moves cells around, so every scenario also checks that it
+// ends with as many cells of each material as it started with and that the
+// census counts them right, and fails if not. It also fails if the batch of
+// random values for a row differs from the values of its cells.
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "block.h"
+#include "census.h"
+#include "consts.h"
+#include "rng.h"
+#include "state.h"
+#include "world.h"
+
+enum {
+  DEFAULT_TICKS = 1000,
+  DEFAULT_SEED = 12345,
+  // Give up waiting for a scenario to come to rest after this many ticks
+  MAX_REST_TICKS = 100000,
+};
+
+// Shorthands for the world size in the scenario setups
+#define W (_state.width)
+#define H (_state.height)
+
+// Fill the rectangle between (x0, y0) and (x1, y1) inclusive. Coordinates
+// outside of the world are ignored by setBlock
+static void fillRect(int x0, int y0, int x1, int y1, enum BlockType type) {
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      setBlock(x, y, NewBlock(type));
+    }
+  }
+}
+
+// A block of sand dropped from the top that settles into a pile
+static void setupSandPile(void) {
+  fillRect(W / 3, H / 2, W * 2 / 3, H - 1, SAND);
+}
+
+// A tall column of water that collapses and spreads over the floor
+static void setupWaterColumn(void) {
+  fillRect(0, 0, W / 4, H - 1, WATER);
+}
+
+// Smoke released along the floor that rises to the ceiling
+static void setupSmokePlume(void) {
+  fillRect(W / 4, 0, W * 3 / 4, H / 6, SMOKE);
+}
+
+// Every material at once: a rock shelf with sand and gravel above it, a water
+// pool underneath and smoke trapped below the shelf
+static void setupMixed(void) {
+  int shelfY = H / 3;
+  fillRect(0, 0, W - 1, H / 8, WATER);
+  fillRect(W / 8, shelfY, W * 5 / 8, shelfY, ROCK);
+  fillRect(W / 4, shelfY + 1, W / 2, shelfY / 2 + shelfY, SMOKE);
+  fillRect(W / 8, H * 2 / 3, W / 2, H - 1, SAND);
+  fillRect(W / 2 + 1, H * 2 / 3, W * 7 / 8, H - 1, GRAVEL);
+}
+
+// A world that is almost entirely solid rock with a small sand pile on top.
+// Once the sand settles there is nothing left to update
+static void setupMostlyStatic(void) {
+  fillRect(0, 0, W - 1, H * 3 / 4, ROCK);
+  fillRect(W / 2 - 4, H * 7 / 8, W / 2 + 4, H - 1, SAND);
+}
+
+// A few grains of sand scattered over the top half of an empty world. Almost
+// every cell is air that never needs updating or drawing
+static void setupSparseSky(void) {
+  for (int i = 0; i < W / 16; i++) {
+    int x = pcg32() % W;
+    int y = H / 2 + pcg32() % (H - H / 2);
+    setBlock(x, y, NewBlock(SAND));
+  }
+}
+
+// A rock basin with the left half of it full of water. Once the dam gives way
+// the water floods the right half and levels out. The basin is an even number
+// of cells wide so the water fills whole rows and the world comes to rest
+static void setupDamBreak(void) {
+  int floorY = H / 8;
+  int half = (W - 2) / 2;
+  int depth = (H - floorY - 1) / 4;
+  fillRect(0, 0, W - 1, floorY, ROCK);
+  fillRect(0, floorY + 1, 0, H - 1, ROCK);
+  fillRect(half * 2 + 1, floorY + 1, W - 1, H - 1, ROCK);
+  fillRect(1, floorY + 1, half, floorY + depth * 2, WATER);
+}
+
+typedef struct {
+  const char *name;
+  void (*setup)(void);
+  // Whether the scenario comes to rest, so the ticks it takes are reported
+  bool settles;
+} scenario;
+
+static const scenario SCENARIOS[] = {
+    {"sand pile", setupSandPile, false},
+    {"water column", setupWaterColumn, false},
+    {"smoke plume", setupSmokePlume, false},
+    {"mixed", setupMixed, false},
+    {"mostly static", setupMostlyStatic, false},
+    {"sparse sky", setupSparseSky, false},
+    {"dam break", setupDamBreak, true},
+};
+
+static double nowSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Whether the world holds as many cells of each material as before
+static bool materialsKept(const uint64_t before[BLOCK_TYPES_COUNT],
+                          const char *name) {
+  uint64_t after[BLOCK_TYPES_COUNT];
+  censusTotals(after);
+  bool kept = true;
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    if (after[type] != before[type]) {
+      fprintf(stderr, "%s: %llu cells of %s, expected %llu\n", name,
+              (unsigned long long)after[type], BLOCKS[type].displayName,
+              (unsigned long long)before[type]);
+      kept = false;
+    }
+  }
+  return kept;
+}
+
+// Whether the census counts the cells of each material in a quarter of the
+// world like counting them one at a time does, and whether the four quarters
+// add up to the totals. The quarters are split off the chunk edges so the
+// counts of the chunks they cut through are looked at too
+static bool countsAgree(const char *name) {
+  int midX = W / 2 + 5;
+  int midY = H / 3 + 7;
+  uint64_t counted[BLOCK_TYPES_COUNT] = {0};
+  for (int y = 0; y < midY; y++) {
+    for (int x = 0; x < midX; x++) {
+      counted[getBlock(x, y)->type]++;
+    }
+  }
+  bool agree = true;
+  for (int type = 0; type < BLOCK_TYPES_COUNT; type++) {
+    uint64_t quarter = censusCount(type, 0, 0, midX - 1, midY - 1);
+    uint64_t quarters = quarter +
+                        censusCount(type, midX, 0, W - 1, midY - 1) +
+                        censusCount(type, 0, midY, midX - 1, H - 1) +
+                        censusCount(type, midX, midY, W - 1, H - 1);
+    if (quarter != counted[type] || quarters != censusTotal(type)) {
+      fprintf(stderr, "%s: census of %s is off\n", name,
+              BLOCKS[type].displayName);
+      agree = false;
+    }
+  }
+  return agree;
+}
+
+// Whether cellRandomRow gives every cell of the world the value cellRandom
+// gives it, for each stream
+static bool rowRandomAgrees(uint64_t seed) {
+  uint64_t *values = malloc((size_t)W * sizeof(uint64_t));
+  if (values == NULL) {
+    return false;
+  }
+  uint64_t key = tickRandomKey(seed, 0);
+  bool agree = true;
+  for (int stream = 0; stream <= RNG_STREAM_FLUID_DIR; stream++) {
+    for (int y = 0; y < H; y++) {
+      cellRandomRow(key, 0, y, W, stream, values);
+      for (int x = 0; x < W; x++) {
+        agree = agree && values[x] == cellRandom(key, x, y, stream);
+      }
+    }
+  }
+  free(values);
+  if (!agree) {
+    fprintf(stderr, "cellRandomRow differs from cellRandom\n");
+  }
+  return agree;
+}
+
+// threads is passed to setTickThreads, 0 runs the serial tick. Returns false
+// if the materials weren't kept or the census is off
+static bool runScenario(const scenario *s, long ticks, uint64_t seed,
+                        int threads) {
+  setTickThreads(threads);
+  pcg32_init(seed);
+  initGameState();
+  s->setup();
+  uint64_t before[BLOCK_TYPES_COUNT];
+  censusTotals(before);
+
+  double start = nowSeconds();
+  for (long i = 0; i < ticks; i++) {
+    worldTick();
+  }
+  double elapsed = nowSeconds() - start;
+
+  double cells = (double)W * H;
+  char threadsText[16] = "serial";
+  if (threads > 0) {
+    snprintf(threadsText, sizeof(threadsText), "%d", threads);
+  }
+  printf("%-14s %8s %8ld %14.1f %10.2f\n", s->name, threadsText, ticks,
+         ticks / elapsed, elapsed * 1e9 / (ticks * cells));
+  bool kept = materialsKept(before, s->name);
+  return countsAgree(s->name) && kept;
+}
+
+// Tick until the world is at rest and report how many ticks and how long that
+// took
+static void runUntilRest(const scenario *s, uint64_t seed, int threads) {
+  setTickThreads(threads);
+  pcg32_init(seed);
+  initGameState();
+  s->setup();
+
+  double start = nowSeconds();
+  long ticks = 0;
+  while (ticks < MAX_REST_TICKS) {
+    worldTick();
+    ticks++;
+    if (worldAtRest()) {
+      break;
+    }
+  }
+  double elapsed = nowSeconds() - start;
+
+  char threadsText[16] = "serial";
+  if (threads > 0) {
+    snprintf(threadsText, sizeof(threadsText), "%d", threads);
+  }
+  if (worldAtRest()) {
+    printf("%-14s %8s %14ld %10.3f\n", s->name, threadsText, ticks, elapsed);
+  } else {
+    printf("%-14s %8s %14s %10.3f\n", s->name, threadsText, "no rest",
+           elapsed);
+  }
+}
+
+// Double the thread count, but always finish on the requested count even if it
+// is not a power of two
+static int nextThreadCount(int threads, int maxThreads) {
+  if (threads < maxThreads && threads * 2 > maxThreads) {
+    return maxThreads;
+  }
+  return threads * 2;
+}
+
+int main(int argc, char **argv) {
+  long ticks = argc > 1 ? strtol(argv[1], NULL, 10) : DEFAULT_TICKS;
+  uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_SEED;
+  int width = DEFAULT_WORLD_WIDTH;
+  int height = DEFAULT_WORLD_HEIGHT;
+  if (argc > 3 && sscanf(argv[3], "%dx%d", &width, &height) != 2) {
+    ticks = 0;
+  }
+  int maxThreads = argc > 4 ? strtol(argv[4], NULL, 10) : 0;
+  if (ticks <= 0 || maxThreads < 0) {
+    fprintf(stderr, "usage: %s [ticks] [seed] [WIDTHxHEIGHT] [threads]\n",
+            argv[0]);
+    return 1;
+  }
+  if (!initWorld(width, height)) {
+    fprintf(stderr, "World size must be between %dx%d and %dx%d\n",
+            MIN_WORLD_SIZE, MIN_WORLD_SIZE, MAX_WORLD_SIZE, MAX_WORLD_SIZE);
+    return 1;
+  }
+
+  InitBlockPalettes();
+
+  printf("world %dx%d, seed %llu\n", W, H, (unsigned long long)seed);
+  printf("%-14s %8s %8s %14s %10s\n", "scenario", "threads", "ticks",
+         "ticks/sec", "ns/cell");
+  bool kept = rowRandomAgrees(seed);
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    kept &= runScenario(&SCENARIOS[i], ticks, seed, 0);
+    for (int threads = 1; threads <= maxThreads;
+         threads = nextThreadCount(threads, maxThreads)) {
+      kept &= runScenario(&SCENARIOS[i], ticks, seed, threads);
+    }
+  }
+
+  printf("\n%-14s %8s %14s %10s\n", "scenario", "threads", "ticks to rest",
+         "seconds");
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    if (!SCENARIOS[i].settles) {
+      continue;
+    }
+    runUntilRest(&SCENARIOS[i], seed, 0);
+    for (int threads = 1; threads <= maxThreads;
+         threads = nextThreadCount(threads, maxThreads)) {
+      runUntilRest(&SCENARIOS[i], seed, threads);
+    }
+  }
+  setTickThreads(0);
+  return kept ? 0 : 1;
+}
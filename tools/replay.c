@@ -0,0 +1,106 @@
+// Headless replay of a recording made with main --record. Runs the recorded
+// game as fast as possible and prints the tick count and world hash after every
+// tick, so two runs can be diffed to find the first tick where they diverge.
+//
+// Usage: replay FILE [--threads N] [--reference]
+//
+// --threads overrides the tick thread count of the recording and --reference
+// runs the plain full scan tick, to compare the optimized ticks against it.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "block.h"
+#include "consts.h"
+#include "journal.h"
+#include "record.h"
+#include "rng.h"
+#include "state.h"
+#include "stream.h"
+#include "world.h"
+
+static void tickAndHash() {
+  worldTick();
+  journalTick();
+  printf("%llu %016llx\n", (unsigned long long)_state.tick,
+         (unsigned long long)worldHash());
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  int threads = -1;
+  bool reference = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--reference") == 0) {
+      reference = true;
+    } else if (path == NULL) {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: %s FILE [--threads N] [--reference]\n", argv[0]);
+    return 1;
+  }
+
+  recording_header header;
+  FILE *file = openRecording(path, &header);
+  if (file == NULL) {
+    fprintf(stderr, "Failed to read the recording %s\n", path);
+    return 1;
+  }
+  if (!initWorld(header.width, header.height)) {
+    fprintf(stderr, "Invalid world size %dx%d in the recording\n",
+            header.width, header.height);
+    return 1;
+  }
+  if (threads < 0) {
+    threads = header.tickThreads;
+  }
+  if (!setTickThreads(threads)) {
+    fprintf(stderr, "Failed to start %d tick threads\n", threads);
+    return 1;
+  }
+  setReferenceTick(reference);
+
+  // The chunks scrolled out of the world are kept in a temporary directory
+  if (!streamInit(NULL, STREAM_BUDGET)) {
+    fprintf(stderr, "Failed to create the chunk store\n");
+    return 1;
+  }
+
+  // Same order as main
+  pcg32_init(header.seed);
+  InitBlockPalettes();
+  initGameState();
+  if (!journalInit(HISTORY_BUDGET)) {
+    fprintf(stderr, "Failed to allocate the undo history\n");
+    streamShutdown();
+    return 1;
+  }
+
+  input_event event;
+  bool ended = false;
+  while (!ended && readEvent(file, &event)) {
+    while (_state.tick < event.tick) {
+      tickAndHash();
+    }
+    applyEvent(&event);
+    ended = event.type == EVENT_END;
+  }
+  if (!ended) {
+    fprintf(stderr, "The recording ends early at tick %llu\n",
+            (unsigned long long)_state.tick);
+  }
+
+  fclose(file);
+  streamShutdown();
+  setTickThreads(0);
+  return ended ? 0 : 1;
+}